@@ -0,0 +1,330 @@
+#include "backup.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+// manufacturer and device ids, a panasonic chip for 64 KiB and a sanyo one for 128 KiB
+static const std::array<std::uint8_t, 2> FLASH64_ID = {0x32, 0x1B};
+static const std::array<std::uint8_t, 2> FLASH128_ID = {0x62, 0x13};
+
+Backup::Type Backup::detect(std::span<const std::uint8_t> rom)
+{
+    static const std::array<std::pair<std::string_view, Type>, 6> LIBRARY_IDS = {{
+        {"EEPROM_V", Type::EEPROM}, {"SRAM_V", Type::SRAM}, {"SRAM_F_V", Type::SRAM},
+        {"FLASH_V", Type::FLASH64}, {"FLASH512_V", Type::FLASH64}, {"FLASH1M_V", Type::FLASH128}
+    }};
+
+    // the ids are word aligned strings
+    for (std::size_t offset = 0; offset + 4 <= rom.size(); offset += 4)
+    {
+        std::uint8_t first = rom[offset];
+        if ((first != 'E') && (first != 'S') && (first != 'F')) continue;
+
+        for (const auto& [id, type] : LIBRARY_IDS)
+        {
+            if ((offset + id.size() <= rom.size()) && (std::memcmp(rom.data() + offset, id.data(), id.size()) == 0))
+            {
+                return type;
+            }
+        }
+    }
+    return Type::NONE;
+}
+
+void Backup::load(std::span<const std::uint8_t> rom, const std::string& save_filepath)
+{
+    flush();
+    m_writer.reset();
+    reset(detect(rom));
+    if (m_type == Type::NONE) return;
+
+    FILE *fp = fopen(save_filepath.c_str(), "rb");
+    if (fp != NULL)
+    {
+        fseek(fp, 0, SEEK_END);
+        std::size_t size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        if (m_type == Type::EEPROM)
+        {
+            set_eeprom_size(size > EEPROM_SMALL_SIZE ? EEPROM_LARGE_SIZE : EEPROM_SMALL_SIZE);
+            m_eeprom_size_known = true;
+        }
+        fread(m_data.data(), sizeof(std::uint8_t), std::min(size, m_data.size()), fp);
+        fclose(fp);
+    }
+    // a new file has to be written out whole the first time anything changes
+    m_write_whole = fp == NULL;
+    m_writer = std::make_unique<SaveWriter>(save_filepath);
+}
+
+void Backup::reset(Type type)
+{
+    m_type = type;
+    switch (type)
+    {
+    case Type::FLASH64: m_data.assign(FLASH_BANK_SIZE, 0xFF); break;
+    case Type::FLASH128: m_data.assign(2 * FLASH_BANK_SIZE, 0xFF); break;
+    case Type::EEPROM: m_data.assign(EEPROM_SMALL_SIZE, 0xFF); break;
+    default: m_data.assign(SRAM_SIZE, 0xFF); break;
+    }
+    m_dirty_start = m_dirty_end = 0;
+    m_write_whole = false;
+
+    m_flash_state = FlashState::READY;
+    m_flash_id_mode = false;
+    m_flash_erase_armed = false;
+    m_flash_bank = 0;
+
+    m_eeprom_state = EepromState::COMMAND;
+    m_eeprom_address_bits = 6;
+    m_eeprom_size_known = false;
+    m_eeprom_bit_count = 0;
+    m_eeprom_command = 0;
+    m_eeprom_address = 0;
+    m_eeprom_buffer = 0;
+    m_eeprom_read_bits = 0;
+}
+
+std::uint8_t Backup::read(std::uint32_t addr) const noexcept
+{
+    switch (m_type)
+    {
+    case Type::FLASH64:
+    case Type::FLASH128:
+        addr &= FLASH_BANK_SIZE - 1;
+        if (m_flash_id_mode && (addr < 2))
+        {
+            return (m_type == Type::FLASH64) ? FLASH64_ID[addr] : FLASH128_ID[addr];
+        }
+        return m_data[(m_flash_bank * FLASH_BANK_SIZE) + addr];
+    // nothing answers on the sram bus of an eeprom cartridge
+    case Type::EEPROM: return 0xFF;
+    default: return m_data[addr & (SRAM_SIZE - 1)];
+    }
+}
+
+void Backup::write(std::uint32_t addr, std::uint8_t value)
+{
+    switch (m_type)
+    {
+    case Type::FLASH64:
+    case Type::FLASH128:
+        write_flash(addr & (FLASH_BANK_SIZE - 1), value);
+        break;
+    case Type::EEPROM: break;
+    default:
+        addr &= SRAM_SIZE - 1;
+        m_data[addr] = value;
+        mark_dirty(addr, addr + 1);
+        break;
+    }
+}
+
+void Backup::write_flash(std::uint32_t addr, std::uint8_t value)
+{
+    switch (m_flash_state)
+    {
+    case FlashState::READY:
+        if ((addr == 0x5555) && (value == 0xAA))
+        {
+            m_flash_state = FlashState::UNLOCK1;
+        }
+        else if (value == 0xF0)
+        {
+            // some chips leave id mode on a bare reset command
+            m_flash_id_mode = false;
+        }
+        break;
+    case FlashState::UNLOCK1:
+        m_flash_state = ((addr == 0x2AAA) && (value == 0x55)) ? FlashState::UNLOCK2 : FlashState::READY;
+        break;
+    case FlashState::UNLOCK2:
+        m_flash_state = FlashState::READY;
+        flash_command(addr, value);
+        break;
+    case FlashState::WRITE:
+    {
+        std::uint32_t offset = (m_flash_bank * FLASH_BANK_SIZE) + addr;
+        m_data[offset] = value;
+        mark_dirty(offset, offset + 1);
+        m_flash_state = FlashState::READY;
+        break;
+    }
+    case FlashState::BANK:
+        if (addr == 0)
+        {
+            m_flash_bank = value & 1;
+        }
+        m_flash_state = FlashState::READY;
+        break;
+    }
+}
+
+void Backup::flash_command(std::uint32_t addr, std::uint8_t value)
+{
+    // erases take two unlocked commands, 0x80 and then the erase itself
+    bool erase_armed = std::exchange(m_flash_erase_armed, false);
+    if ((value == 0x30) && erase_armed)
+    {
+        std::uint32_t offset = (m_flash_bank * FLASH_BANK_SIZE) + (addr & ~(FLASH_SECTOR_SIZE - 1));
+        std::fill_n(m_data.begin() + offset, FLASH_SECTOR_SIZE, 0xFF);
+        mark_dirty(offset, offset + FLASH_SECTOR_SIZE);
+        return;
+    }
+    if (addr != 0x5555) return;
+
+    switch (value)
+    {
+    case 0x10:
+        if (erase_armed)
+        {
+            std::fill(m_data.begin(), m_data.end(), 0xFF);
+            mark_dirty(0, m_data.size());
+        }
+        break;
+    case 0x80: m_flash_erase_armed = true; break;
+    case 0x90: m_flash_id_mode = true; break;
+    case 0xA0: m_flash_state = FlashState::WRITE; break;
+    case 0xB0:
+        if (m_type == Type::FLASH128)
+        {
+            m_flash_state = FlashState::BANK;
+        }
+        break;
+    case 0xF0: m_flash_id_mode = false; break;
+    }
+}
+
+std::uint16_t Backup::read_eeprom() noexcept
+{
+    // reads are ready straight away, as are writes so the busy flag is never seen
+    if (m_eeprom_read_bits == 0) return 1;
+
+    int bit = --m_eeprom_read_bits;
+    if (bit >= 64) return 0;
+    return (m_eeprom_buffer >> bit) & 1;
+}
+
+void Backup::write_eeprom(std::uint16_t value)
+{
+    std::uint32_t bit = value & 1;
+    switch (m_eeprom_state)
+    {
+    case EepromState::COMMAND:
+        m_eeprom_command = (m_eeprom_command << 1) | bit;
+        if (++m_eeprom_bit_count == 2)
+        {
+            m_eeprom_state = EepromState::ADDRESS;
+            m_eeprom_bit_count = 0;
+            m_eeprom_address = 0;
+        }
+        break;
+    case EepromState::ADDRESS:
+        m_eeprom_address = (m_eeprom_address << 1) | bit;
+        if (++m_eeprom_bit_count == m_eeprom_address_bits)
+        {
+            // 0b10 is a write followed by a double word, 0b11 a read
+            m_eeprom_state = (m_eeprom_command == 0b10) ? EepromState::DATA : EepromState::STOP;
+            m_eeprom_bit_count = 0;
+            m_eeprom_buffer = 0;
+        }
+        break;
+    case EepromState::DATA:
+        m_eeprom_buffer = (m_eeprom_buffer << 1) | bit;
+        if (++m_eeprom_bit_count == 64)
+        {
+            m_eeprom_state = EepromState::STOP;
+        }
+        break;
+    case EepromState::STOP:
+    {
+        // double words are stored with the first bit sent as the top bit of the first byte
+        std::uint32_t offset = (m_eeprom_address * 8) & (m_data.size() - 1);
+        if (m_eeprom_command == 0b11)
+        {
+            m_eeprom_buffer = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                m_eeprom_buffer = (m_eeprom_buffer << 8) | m_data[offset + i];
+            }
+            m_eeprom_read_bits = 68;
+        }
+        else if (m_eeprom_command == 0b10)
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                m_data[offset + i] = m_eeprom_buffer >> (56 - (i * 8));
+            }
+            mark_dirty(offset, offset + 8);
+        }
+        m_eeprom_state = EepromState::COMMAND;
+        m_eeprom_bit_count = 0;
+        m_eeprom_command = 0;
+        break;
+    }
+    }
+}
+
+void Backup::eeprom_transfer(std::uint32_t units)
+{
+    if ((m_type != Type::EEPROM) || m_eeprom_size_known) return;
+
+    // read requests are 2 + address + 1 bits long and writes carry 64 more
+    switch (units)
+    {
+    case 9:
+    case 73:
+        set_eeprom_size(EEPROM_SMALL_SIZE);
+        m_eeprom_size_known = true;
+        break;
+    case 17:
+    case 81:
+        set_eeprom_size(EEPROM_LARGE_SIZE);
+        m_eeprom_size_known = true;
+        break;
+    }
+}
+
+void Backup::set_eeprom_size(std::uint32_t size)
+{
+    m_eeprom_address_bits = (size == EEPROM_LARGE_SIZE) ? 14 : 6;
+    if (size != m_data.size())
+    {
+        m_data.resize(size, 0xFF);
+        m_write_whole = true;
+    }
+}
+
+void Backup::mark_dirty(std::size_t start, std::size_t end) noexcept
+{
+    if (m_dirty_start == m_dirty_end)
+    {
+        m_dirty_start = start;
+        m_dirty_end = end;
+    }
+    else
+    {
+        m_dirty_start = std::min(m_dirty_start, start);
+        m_dirty_end = std::max(m_dirty_end, end);
+    }
+}
+
+void Backup::flush()
+{
+    if (m_dirty_start == m_dirty_end) return;
+
+    if (m_writer)
+    {
+        if (std::exchange(m_write_whole, false))
+        {
+            m_dirty_start = 0;
+            m_dirty_end = m_data.size();
+        }
+        m_writer->submit(m_data.data(), m_data.size(), m_dirty_start, m_dirty_end);
+    }
+    m_dirty_start = m_dirty_end = 0;
+}
@@ -0,0 +1,98 @@
+#ifndef BACKUP_HPP
+#define BACKUP_HPP
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "save_writer.hpp"
+
+// Cartridge save memory. The type comes from the library id string the sdk links into the rom,
+// the contents are loaded from a battery file next to it and kept up to date by a SaveWriter.
+class Backup
+{
+    public:
+        enum class Type : std::uint8_t
+        {
+            //! no id string, behaves like sram but isn't saved
+            NONE = 0, SRAM, FLASH64, FLASH128, EEPROM
+        };
+
+        Backup() { reset(Type::NONE); }
+        //! hands the last changes to the writer
+        ~Backup() { flush(); }
+
+        Backup(const Backup&) = delete;
+        Backup& operator=(const Backup&) = delete;
+
+        static Type detect(std::span<const std::uint8_t> rom);
+
+        //! picks the type for a rom and loads the battery file at save_filepath if there is one
+        void load(std::span<const std::uint8_t> rom, const std::string& save_filepath);
+        Type type() const noexcept { return m_type; }
+
+        //! sram and flash on the 8 bit bus at 0x0E000000
+        std::uint8_t read(std::uint32_t addr) const noexcept;
+        void write(std::uint32_t addr, std::uint8_t value);
+
+        //! eeprom is serial, every access moves one bit in bit 0
+        std::uint16_t read_eeprom() noexcept;
+        void write_eeprom(std::uint16_t value);
+        //! a dma of units to or from the eeprom, the length of the request gives away the address width
+        void eeprom_transfer(std::uint32_t units);
+
+        //! hands whatever changed since the last call to the writer thread
+        void flush();
+
+    private:
+        static constexpr std::uint32_t SRAM_SIZE = 0x8000;
+        static constexpr std::uint32_t FLASH_BANK_SIZE = 0x10000;
+        static constexpr std::uint32_t FLASH_SECTOR_SIZE = 0x1000;
+        static constexpr std::uint32_t EEPROM_SMALL_SIZE = 0x200;
+        static constexpr std::uint32_t EEPROM_LARGE_SIZE = 0x2000;
+
+        enum class FlashState : std::uint8_t
+        {
+            READY = 0, UNLOCK1, UNLOCK2, WRITE, BANK
+        };
+
+        enum class EepromState : std::uint8_t
+        {
+            COMMAND = 0, ADDRESS, DATA, STOP
+        };
+
+        void reset(Type type);
+        void write_flash(std::uint32_t addr, std::uint8_t value);
+        void flash_command(std::uint32_t addr, std::uint8_t value);
+        void set_eeprom_size(std::uint32_t size);
+        void mark_dirty(std::size_t start, std::size_t end) noexcept;
+
+        Type m_type = Type::NONE;
+        std::vector<std::uint8_t> m_data;
+        std::unique_ptr<SaveWriter> m_writer;
+        // range changed since the last flush, empty when start == end
+        std::size_t m_dirty_start = 0;
+        std::size_t m_dirty_end = 0;
+        //! set until the whole image has been handed to the writer once, e.g. when there was no file yet
+        bool m_write_whole = false;
+
+        FlashState m_flash_state = FlashState::READY;
+        bool m_flash_id_mode = false;
+        bool m_flash_erase_armed = false;
+        std::uint32_t m_flash_bank = 0;
+
+        EepromState m_eeprom_state = EepromState::COMMAND;
+        int m_eeprom_address_bits = 6;
+        //! false until the address width is known from the save file or the first transfer
+        bool m_eeprom_size_known = false;
+        int m_eeprom_bit_count = 0;
+        std::uint8_t m_eeprom_command = 0;
+        std::uint32_t m_eeprom_address = 0;
+        std::uint64_t m_eeprom_buffer = 0;
+        //! bits left of a read, the first four are ignored by the game
+        int m_eeprom_read_bits = 0;
+};
+
+#endif
@@ -0,0 +1,439 @@
+#include "cpu.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+
+// sin(2 * pi * n / 256) in 2.14 fixed point, as stored in the bios rom
+static const std::uint32_t BIOS_SINE_TABLE = 0x00000D5C;
+// where bios calls return to in the swi dispatcher
+static const std::uint32_t BIOS_SWI_RETURN = 0x00000170;
+
+//! cycles a call costs, a fixed setup plus a cost per unit of data, measured on the bios rom path of this core
+struct BiosCallCost
+{
+    int base;
+    int per_unit;
+};
+
+static constexpr std::array<BiosCallCost, 0x16> BIOS_CALL_COSTS = ([]() constexpr -> auto {
+    std::array<BiosCallCost, 0x16> costs{};
+    costs[0x06] = {40, 9}; // Div, per quotient bit
+    costs[0x08] = {330, 0}; // Sqrt
+    costs[0x09] = {55, 0}; // ArcTan
+    costs[0x0B] = {40, 5}; // CpuSet, per unit
+    costs[0x0C] = {45, 3}; // CpuFastSet, per block of 8 words
+    costs[0x0E] = {26, 42}; // BgAffineSet, per entry
+    costs[0x0F] = {26, 28}; // ObjAffineSet, per entry
+    costs[0x11] = {75, 6}; // LZ77UnCompWram, per output byte
+    costs[0x12] = {130, 17}; // LZ77UnCompVram, per output byte
+    costs[0x13] = {250, 45}; // HuffUnComp, per output byte
+    costs[0x14] = {230, 5}; // RLUnCompWram, per output byte
+    costs[0x15] = {480, 10}; // RLUnCompVram, per output byte
+    return costs;
+})();
+
+static int bios_call_cost(std::uint8_t number, std::uint32_t units)
+{
+    const auto& cost = BIOS_CALL_COSTS[number];
+    return cost.base + (cost.per_unit * units);
+}
+
+//! the range check the bios runs before copying or decompressing, sources in the bios itself are refused
+static bool bios_source_allowed(std::uint32_t src, std::uint32_t length)
+{
+    return (length != 0) && (src & 0x0E000000) && ((src + (length & 0x01FFFFFF)) & 0x0E000000);
+}
+
+//! shift and subtract division as the bios loops do it
+static std::uint32_t bios_divide(std::uint32_t num, std::uint32_t denom)
+{
+    std::uint32_t shifted = denom;
+    while (shifted <= (num >> 1))
+    {
+        bool again = shifted < (num >> 1);
+        shifted <<= 1;
+        if (!again) break;
+    }
+
+    std::uint32_t quot = 0;
+    while (true)
+    {
+        bool fits = num >= shifted;
+        quot = (quot << 1) | fits;
+        num -= fits ? shifted : 0;
+        if (shifted == denom) break;
+        shifted >>= 1;
+    }
+    return quot;
+}
+
+int CPU::hle_swi(std::uint8_t number)
+{
+    switch (number)
+    {
+    case 0x06: return hle_div();
+    case 0x08: return hle_sqrt();
+    case 0x09: return hle_arctan();
+    case 0x0B: return hle_cpu_set();
+    case 0x0C: return hle_cpu_fast_set();
+    case 0x0E: return hle_bg_affine_set();
+    case 0x0F: return hle_obj_affine_set();
+    case 0x11: return hle_lz77_uncomp<false>();
+    case 0x12: return hle_lz77_uncomp<true>();
+    case 0x13: return hle_huff_uncomp();
+    case 0x14: return hle_rl_uncomp<false>();
+    case 0x15: return hle_rl_uncomp<true>();
+    default: return 0;
+    }
+}
+
+int CPU::hle_div()
+{
+    auto num = static_cast<std::int32_t>(m_regs[0]);
+    auto denom = static_cast<std::int32_t>(m_regs[1]);
+    // the bios hangs on a zero divisor, leave that and the overflow case to it
+    if ((denom == 0) || ((num == INT32_MIN) && (denom == -1))) return 0;
+
+    std::int32_t quot = num / denom;
+    m_regs[0] = quot;
+    m_regs[1] = num % denom;
+    m_regs[3] = std::abs(quot);
+    // the bios shifts the divisor up to the numerator, one step per quotient bit
+    int num_bits = std::bit_width(static_cast<std::uint32_t>(std::abs(static_cast<std::int64_t>(num))));
+    int denom_bits = std::bit_width(static_cast<std::uint32_t>(std::abs(static_cast<std::int64_t>(denom))));
+    return bios_call_cost(0x06, std::max(num_bits - denom_bits, 0));
+}
+
+int CPU::hle_sqrt()
+{
+    // newton iteration from the next power of two, r1 and r3 keep the last estimate and quotient
+    std::uint32_t value = m_regs[0];
+    std::uint32_t estimate = 1;
+    for (std::uint32_t rest = value; rest > estimate; rest >>= 1)
+    {
+        estimate <<= 1;
+    }
+
+    std::uint32_t root = 0;
+    std::uint32_t quot = 0;
+    do
+    {
+        root = estimate;
+        quot = bios_divide(value, root);
+        estimate = (root + quot) >> 1;
+    } while (estimate < root);
+
+    m_regs[0] = root;
+    m_regs[1] = estimate;
+    m_regs[3] = quot;
+    return bios_call_cost(0x08, 0);
+}
+
+int CPU::hle_arctan()
+{
+    // the bios multiplies with MUL, products wrap at 32 bits before the arithmetic shift
+    auto mul = [](std::int32_t x, std::int32_t y) {
+        return static_cast<std::int32_t>(static_cast<std::uint32_t>(x) * static_cast<std::uint32_t>(y));
+    };
+    auto tan = static_cast<std::int32_t>(m_regs[0]);
+    std::int32_t a = -(mul(tan, tan) >> 14);
+    std::int32_t b = (mul(0xA9, a) >> 14) + 0x390;
+    b = (mul(b, a) >> 14) + 0x91C;
+    b = (mul(b, a) >> 14) + 0xFB6;
+    b = (mul(b, a) >> 14) + 0x16AA;
+    b = (mul(b, a) >> 14) + 0x2081;
+    b = (mul(b, a) >> 14) + 0x3651;
+    b = (mul(b, a) >> 14) + 0xA2F9;
+    m_regs[0] = mul(tan, b) >> 16;
+    m_regs[1] = a;
+    m_regs[3] = b;
+    return bios_call_cost(0x09, 0);
+}
+
+int CPU::hle_cpu_set()
+{
+    std::uint32_t src = m_regs[0];
+    std::uint32_t dst = m_regs[1];
+    std::uint32_t control = m_regs[2];
+    std::uint32_t count = control & 0x1FFFFF;
+    bool fill = (control >> 24) & 1;
+    bool word = (control >> 26) & 1;
+
+    // thumb routines return through r3, which is left holding the swi dispatcher address
+    m_regs[3] = BIOS_SWI_RETURN;
+    if (!bios_source_allowed(src, count * 4)) return bios_call_cost(0x0B, 0);
+
+    if (word)
+    {
+        std::uint32_t value = m_mem.read<std::uint32_t>(src);
+        for (std::uint32_t i = 0; i < count; i++)
+        {
+            m_mem.write<std::uint32_t>(dst + (i * 4), fill ? value : m_mem.read<std::uint32_t>(src + (i * 4)));
+        }
+        // only the word sized loops advance the pointers
+        m_regs[0] = src + (fill ? 4 : (count * 4));
+        m_regs[1] = dst + (count * 4);
+    }
+    else
+    {
+        // a misaligned ldrh rotates the halfword into the top of the register, only its high byte is stored back
+        std::uint16_t value = m_mem.read<std::uint16_t>(src);
+        for (std::uint32_t i = 0; i < count; i++)
+        {
+            if (!fill)
+            {
+                value = m_mem.read<std::uint16_t>(src + (i * 2));
+            }
+            m_mem.write<std::uint16_t>(dst + (i * 2), (src & 1) ? (value >> 8) : value);
+        }
+    }
+    return bios_call_cost(0x0B, count);
+}
+
+int CPU::hle_cpu_fast_set()
+{
+    std::uint32_t src = m_regs[0];
+    std::uint32_t dst = m_regs[1];
+    std::uint32_t control = m_regs[2];
+    // whole blocks of eight words are moved, the count is rounded up
+    std::uint32_t count = ((control & 0x1FFFFF) + 7) & ~7;
+    bool fill = (control >> 24) & 1;
+    if (!bios_source_allowed(src, (control & 0x1FFFFF) * 4)) return bios_call_cost(0x0C, 0);
+
+    std::uint32_t value = ror(m_mem.read<std::uint32_t>(src), (src & 0x3) * 8);
+    for (std::uint32_t i = 0; i < count; i++)
+    {
+        if (!fill)
+        {
+            value = m_mem.read<std::uint32_t>(src + (i * 4));
+        }
+        m_mem.write<std::uint32_t>(dst + (i * 4), value);
+    }
+    // r3 is the second word of the last block moved
+    m_regs[0] = src + (fill ? 0 : (count * 4));
+    m_regs[1] = dst + (count * 4);
+    m_regs[3] = fill ? value : m_mem.read<std::uint32_t>(src + (count * 4) - 28);
+    return bios_call_cost(0x0C, count / 8);
+}
+
+int CPU::hle_bg_affine_set()
+{
+    std::uint32_t src = m_regs[0];
+    std::uint32_t dst = m_regs[1];
+    auto count = static_cast<std::int32_t>(m_regs[2]);
+    for (std::int32_t i = 0; i < count; i++, src += 20, dst += 16)
+    {
+        auto ox = static_cast<std::int32_t>(m_mem.read<std::uint32_t>(src));
+        auto oy = static_cast<std::int32_t>(m_mem.read<std::uint32_t>(src + 4));
+        auto cx = static_cast<std::int16_t>(m_mem.read<std::uint16_t>(src + 8));
+        auto cy = static_cast<std::int16_t>(m_mem.read<std::uint16_t>(src + 10));
+        auto sx = static_cast<std::int16_t>(m_mem.read<std::uint16_t>(src + 12));
+        auto sy = static_cast<std::int16_t>(m_mem.read<std::uint16_t>(src + 14));
+        std::uint8_t theta = m_mem.read<std::uint16_t>(src + 16) >> 8;
+
+        auto sin = static_cast<std::int16_t>(m_mem.read<std::uint16_t>(BIOS_SINE_TABLE + (theta * 2)));
+        auto cos = static_cast<std::int16_t>(m_mem.read<std::uint16_t>(BIOS_SINE_TABLE + (static_cast<std::uint8_t>(theta + 0x40) * 2)));
+        std::int32_t pa = (sx * cos) >> 14;
+        std::int32_t pb = -((sx * sin) >> 14);
+        std::int32_t pc = (sy * sin) >> 14;
+        std::int32_t pd = (sy * cos) >> 14;
+
+        m_mem.write<std::uint16_t>(dst, pa);
+        m_mem.write<std::uint16_t>(dst + 2, pb);
+        m_mem.write<std::uint16_t>(dst + 4, pc);
+        m_mem.write<std::uint16_t>(dst + 6, pd);
+        m_mem.write<std::uint32_t>(dst + 8, ox - ((pa * cx) + (pb * cy)));
+        m_mem.write<std::uint32_t>(dst + 12, oy - ((pc * cx) + (pd * cy)));
+        m_regs[3] = pa;
+    }
+    m_regs[0] = src;
+    m_regs[1] = dst;
+    return bios_call_cost(0x0E, std::max(count, 0));
+}
+
+int CPU::hle_obj_affine_set()
+{
+    std::uint32_t src = m_regs[0];
+    std::uint32_t dst = m_regs[1];
+    auto count = static_cast<std::int32_t>(m_regs[2]);
+    std::uint32_t stride = m_regs[3];
+    for (std::int32_t i = 0; i < count; i++, src += 8, dst += stride * 4)
+    {
+        auto sx = static_cast<std::int16_t>(m_mem.read<std::uint16_t>(src));
+        auto sy = static_cast<std::int16_t>(m_mem.read<std::uint16_t>(src + 2));
+        std::uint8_t theta = m_mem.read<std::uint16_t>(src + 4) >> 8;
+
+        auto sin = static_cast<std::int16_t>(m_mem.read<std::uint16_t>(BIOS_SINE_TABLE + (theta * 2)));
+        auto cos = static_cast<std::int16_t>(m_mem.read<std::uint16_t>(BIOS_SINE_TABLE + (static_cast<std::uint8_t>(theta + 0x40) * 2)));
+        m_mem.write<std::uint16_t>(dst, (sx * cos) >> 14);
+        m_mem.write<std::uint16_t>(dst + stride, -((sx * sin) >> 14));
+        m_mem.write<std::uint16_t>(dst + (stride * 2), (sy * sin) >> 14);
+        m_mem.write<std::uint16_t>(dst + (stride * 3), (sy * cos) >> 14);
+    }
+    m_regs[0] = src;
+    m_regs[1] = dst;
+    return bios_call_cost(0x0F, std::max(count, 0));
+}
+
+template <bool Vram>
+void CPU::hle_write_byte(std::uint32_t& dst, std::uint32_t& pending, int& shift, std::uint8_t value)
+{
+    if constexpr (Vram)
+    {
+        // vram takes halfwords only, two bytes are gathered before each store
+        pending |= value << shift;
+        shift ^= 8;
+        if (shift == 0)
+        {
+            m_mem.write<std::uint16_t>(dst, pending);
+            dst += 2;
+            pending = 0;
+        }
+    }
+    else
+    {
+        m_mem.write<std::uint8_t>(dst++, value);
+    }
+}
+
+template <bool Vram>
+int CPU::hle_lz77_uncomp()
+{
+    std::uint32_t src = m_regs[0] + 4;
+    std::uint32_t dst = m_regs[1];
+    std::uint32_t size = m_mem.read<std::uint32_t>(m_regs[0]) >> 8;
+    if (!bios_source_allowed(src, size))
+    {
+        m_regs[0] = src;
+        m_regs[3] = Vram ? 0 : m_regs[3];
+        return bios_call_cost(Vram ? 0x12 : 0x11, 0);
+    }
+
+    // like the bios, a reference is always copied in full even when it runs past the size
+    auto remaining = static_cast<std::int32_t>(size);
+    std::uint32_t pending = Vram ? 0 : m_regs[3];
+    int shift = 0;
+    while (remaining > 0)
+    {
+        std::uint8_t flags = m_mem.read<std::uint8_t>(src++);
+        for (int block = 0; (block < 8) && (remaining > 0); block++, flags <<= 1)
+        {
+            if (!(flags & 0x80))
+            {
+                hle_write_byte<Vram>(dst, pending, shift, m_mem.read<std::uint8_t>(src++));
+                remaining--;
+                continue;
+            }
+
+            std::uint8_t hi = m_mem.read<std::uint8_t>(src++);
+            std::uint8_t lo = m_mem.read<std::uint8_t>(src++);
+            std::uint32_t disp = (((hi & 0xF) << 8) | lo) + 1;
+            int length = (hi >> 4) + 3;
+            remaining -= length;
+            for (int i = 0; i < length; i++)
+            {
+                hle_write_byte<Vram>(dst, pending, shift, m_mem.read<std::uint8_t>(dst + (shift >> 3) - disp));
+            }
+            if constexpr (!Vram)
+            {
+                pending = 0;
+            }
+        }
+    }
+    m_regs[0] = src;
+    m_regs[1] = dst;
+    m_regs[3] = pending;
+    return bios_call_cost(Vram ? 0x12 : 0x11, size);
+}
+
+template <bool Vram>
+int CPU::hle_rl_uncomp()
+{
+    std::uint32_t src = m_regs[0] + 4;
+    std::uint32_t dst = m_regs[1];
+    std::uint32_t size = m_mem.read<std::uint32_t>(m_regs[0]) >> 8;
+    m_regs[3] = BIOS_SWI_RETURN;
+    if (!bios_source_allowed(src, size))
+    {
+        m_regs[0] = src;
+        return bios_call_cost(Vram ? 0x15 : 0x14, 0);
+    }
+
+    auto remaining = static_cast<std::int32_t>(size);
+    std::uint32_t pending = 0;
+    int shift = 0;
+    while (remaining > 0)
+    {
+        std::uint8_t flag = m_mem.read<std::uint8_t>(src++);
+        if (flag & 0x80)
+        {
+            int length = (flag & 0x7F) + 3;
+            std::uint8_t value = m_mem.read<std::uint8_t>(src++);
+            for (int i = 0; i < length; i++)
+            {
+                hle_write_byte<Vram>(dst, pending, shift, value);
+            }
+            remaining -= length;
+        }
+        else
+        {
+            int length = flag + 1;
+            for (int i = 0; i < length; i++)
+            {
+                hle_write_byte<Vram>(dst, pending, shift, m_mem.read<std::uint8_t>(src++));
+            }
+            remaining -= length;
+        }
+    }
+    m_regs[0] = src;
+    m_regs[1] = dst;
+    return bios_call_cost(Vram ? 0x15 : 0x14, size);
+}
+
+int CPU::hle_huff_uncomp()
+{
+    std::uint32_t src = m_regs[0];
+    std::uint32_t dst = m_regs[1];
+    if (!bios_source_allowed(src, 0x02000000)) return bios_call_cost(0x13, 0);
+
+    std::uint32_t header = m_mem.read<std::uint32_t>(src);
+    std::uint8_t data_bits = header & 0xF;
+    int units_per_word = (data_bits & 7) + 4;
+    auto remaining = static_cast<std::int32_t>(header >> 8);
+    std::uint32_t root = src + 5;
+    std::uint32_t bitstream = src + 4 + ((m_mem.read<std::uint8_t>(src + 4) + 1) * 2);
+
+    // units are shifted in from the top, a full word holds the first unit in its low bits
+    std::uint32_t node = root;
+    std::uint32_t output = 0;
+    int units = 0;
+    while (remaining > 0)
+    {
+        std::uint32_t bits = m_mem.read<std::uint32_t>(bitstream);
+        bitstream += 4;
+        for (int i = 0; (i < 32) && (remaining > 0); i++, bits <<= 1)
+        {
+            std::uint8_t entry = m_mem.read<std::uint8_t>(node);
+            std::uint32_t bit = bits >> 31;
+            bool leaf = (entry << bit) & 0x80;
+            node = (node & ~1) + (((entry & 0x3F) + 1) * 2) + bit;
+            if (!leaf) continue;
+
+            std::uint64_t data = m_mem.read<std::uint8_t>(node);
+            output = (output >> data_bits) | static_cast<std::uint32_t>(data << (32 - data_bits));
+            node = root;
+            if (++units == units_per_word)
+            {
+                m_mem.write<std::uint32_t>(dst, output);
+                dst += 4;
+                remaining -= 4;
+                units = 0;
+            }
+        }
+    }
+    m_regs[0] = bitstream;
+    m_regs[1] = dst;
+    m_regs[3] = output;
+    return bios_call_cost(0x13, header >> 8);
+}
@@ -0,0 +1,84 @@
+#include "block_cache.hpp"
+
+#include <algorithm>
+
+Block* BlockCache::lookup_slow(std::uint32_t block_key)
+{
+    auto it = m_blocks.find(block_key);
+    if (it == m_blocks.end())
+    {
+        return nullptr;
+    }
+    m_fast_lookup[slot(block_key)] = {block_key, &it->second};
+    return &it->second;
+}
+
+Block& BlockCache::insert(std::uint32_t pc, bool thumb, Block&& block)
+{
+    std::uint32_t block_key = key(pc, thumb);
+    if (auto it = m_blocks.find(block_key); it != m_blocks.end())
+    {
+        for (auto page : it->second.pages) unlink_page(page, block_key);
+    }
+    Block& inserted = m_blocks.insert_or_assign(block_key, std::move(block)).first->second;
+    m_fast_lookup[slot(block_key)] = {block_key, &inserted};
+    return inserted;
+}
+
+void BlockCache::link_page(std::uint16_t page, std::uint32_t pc, bool thumb)
+{
+    std::uint32_t block_key = key(pc, thumb);
+    auto it = m_blocks.find(block_key);
+    if (it == m_blocks.end()) return;
+
+    auto& pages = it->second.pages;
+    if (std::find(pages.begin(), pages.end(), page) != pages.end()) return;
+    pages.push_back(page);
+    m_page_blocks[page].push_back(block_key);
+}
+
+void BlockCache::unlink_page(std::uint16_t page, std::uint32_t block_key)
+{
+    auto it = m_page_blocks.find(page);
+    if (it == m_page_blocks.end()) return;
+
+    auto& keys = it->second;
+    keys.erase(std::remove(keys.begin(), keys.end(), block_key), keys.end());
+    if (keys.empty()) m_page_blocks.erase(it);
+}
+
+void BlockCache::invalidate_page(std::uint16_t page)
+{
+    auto it = m_page_blocks.find(page);
+    if (it == m_page_blocks.end()) return;
+
+    // taken out first, a block spanning two pages is unlinked from the other one below
+    std::vector<std::uint32_t> block_keys = std::move(it->second);
+    m_page_blocks.erase(it);
+
+    for (auto block_key : block_keys)
+    {
+        auto block = m_blocks.find(block_key);
+        if (block == m_blocks.end()) continue;
+        for (auto linked_page : block->second.pages)
+        {
+            if (linked_page != page) unlink_page(linked_page, block_key);
+        }
+
+        auto& fast_entry = m_fast_lookup[slot(block_key)];
+        if (fast_entry.first == block_key)
+        {
+            fast_entry = {0, nullptr};
+        }
+        m_blocks.erase(block);
+    }
+}
+
+void BlockCache::drop_compiled_code()
+{
+    for (auto& [block_key, block] : m_blocks)
+    {
+        block.code = nullptr;
+        block.hits = 0;
+    }
+}
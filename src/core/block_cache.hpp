@@ -0,0 +1,67 @@
+#ifndef BLOCK_CACHE_HPP
+#define BLOCK_CACHE_HPP
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class CPU;
+
+struct DecodedInstr
+{
+    int (CPU::*handler)(std::uint32_t);
+    std::uint32_t instr;
+};
+
+typedef int (*CompiledBlock)(CPU* cpu, std::uint32_t* regs, std::uint8_t* flags);
+
+struct Block
+{
+    std::uint32_t start;
+    std::uint32_t end;
+    std::vector<DecodedInstr> instrs;
+    CompiledBlock code = nullptr;
+    std::uint32_t hits = 0;
+    // loop back to start that only loads and compares, nothing it reads changes before the next event
+    bool idle_loop = false;
+    // code pages the block is linked to, a write to any of them drops it from all of them
+    std::vector<std::uint16_t> pages;
+};
+
+class BlockCache
+{
+    public:
+        Block* lookup(std::uint32_t pc, bool thumb)
+        {
+            std::uint32_t block_key = key(pc, thumb);
+            const auto& [fast_key, fast_block] = m_fast_lookup[slot(block_key)];
+            if ((fast_block != nullptr) && (fast_key == block_key)) [[likely]]
+            {
+                return fast_block;
+            }
+            return lookup_slow(block_key);
+        }
+        Block& insert(std::uint32_t pc, bool thumb, Block&& block);
+
+        //! ties a block to a code page of writable memory so that a write to that page drops it
+        void link_page(std::uint16_t page, std::uint32_t pc, bool thumb);
+        void invalidate_page(std::uint16_t page);
+        void drop_compiled_code();
+
+    private:
+        Block* lookup_slow(std::uint32_t block_key);
+        void unlink_page(std::uint16_t page, std::uint32_t block_key);
+
+        static std::uint32_t key(std::uint32_t pc, bool thumb) noexcept { return pc | thumb; }
+        static std::size_t slot(std::uint32_t key) noexcept { return (key >> 1) & (FAST_LOOKUP_SLOTS - 1); }
+
+        static constexpr std::size_t FAST_LOOKUP_SLOTS = 4096;
+
+        // direct-mapped front for the hash map, hot loops resolve their blocks without hashing
+        std::array<std::pair<std::uint32_t, Block*>, FAST_LOOKUP_SLOTS> m_fast_lookup{};
+        std::unordered_map<std::uint32_t, Block> m_blocks;
+        std::unordered_map<std::uint16_t, std::vector<std::uint32_t>> m_page_blocks;
+};
+
+#endif
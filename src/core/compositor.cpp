@@ -0,0 +1,154 @@
+#include "compositor.hpp"
+
+#include <algorithm>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define COMPOSITOR_X86 1
+#include <immintrin.h>
+#endif
+
+#ifdef COMPOSITOR_X86
+// sse2 comes with every x86-64 cpu but has no 32 bit min, the compare mask selects the smaller value
+static void compose_line_sse2(const std::uint32_t* const* layers, int count, std::uint32_t backdrop, std::uint16_t* out)
+{
+    const __m128i colour_mask = _mm_set1_epi32(0x7FFF);
+    for (int x = 0; x < LINE_WIDTH; x += 8)
+    {
+        __m128i low = _mm_set1_epi32(backdrop);
+        __m128i high = low;
+        for (int layer = 0; layer < count; layer++)
+        {
+            __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(layers[layer] + x));
+            __m128i in_front = _mm_cmplt_epi32(pixels, low);
+            low = _mm_or_si128(_mm_and_si128(in_front, pixels), _mm_andnot_si128(in_front, low));
+
+            pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(layers[layer] + x + 4));
+            in_front = _mm_cmplt_epi32(pixels, high);
+            high = _mm_or_si128(_mm_and_si128(in_front, pixels), _mm_andnot_si128(in_front, high));
+        }
+        // colours fit in 15 bits so the signed saturating pack doesn't change them
+        __m128i colours = _mm_packs_epi32(_mm_and_si128(low, colour_mask), _mm_and_si128(high, colour_mask));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), colours);
+    }
+}
+
+static void expand_line_sse2(const std::uint16_t* colours, int count, std::uint32_t order, std::uint32_t* out)
+{
+    const __m128i colour_mask = _mm_set1_epi16(0x7FFF);
+    const __m128i order_bits = _mm_set1_epi32(order);
+    for (int x = 0; x < count; x += 8)
+    {
+        __m128i pixels = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(colours + x)), colour_mask);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_or_si128(_mm_unpacklo_epi16(pixels, _mm_setzero_si128()), order_bits));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x + 4), _mm_or_si128(_mm_unpackhi_epi16(pixels, _mm_setzero_si128()), order_bits));
+    }
+}
+
+[[gnu::target("avx2")]] static void compose_line_avx2(const std::uint32_t* const* layers, int count, std::uint32_t backdrop, std::uint16_t* out)
+{
+    const __m256i colour_mask = _mm256_set1_epi32(0x7FFF);
+    for (int x = 0; x < LINE_WIDTH; x += 16)
+    {
+        __m256i low = _mm256_set1_epi32(backdrop);
+        __m256i high = low;
+        for (int layer = 0; layer < count; layer++)
+        {
+            low = _mm256_min_epi32(low, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(layers[layer] + x)));
+            high = _mm256_min_epi32(high, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(layers[layer] + x + 8)));
+        }
+        // the pack works within 128 bit lanes, the permute puts the four quarters back in order
+        __m256i colours = _mm256_packs_epi32(_mm256_and_si256(low, colour_mask), _mm256_and_si256(high, colour_mask));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_permute4x64_epi64(colours, 0xD8));
+    }
+}
+
+// the gather reads two bytes past the colour of each index, which stays inside palette ram
+[[gnu::target("avx2")]] static void lookup_line_avx2(const std::uint8_t* indices, const std::uint16_t* palette, int count, std::uint32_t order, std::uint32_t* out)
+{
+    const __m256i colour_mask = _mm256_set1_epi32(0x7FFF);
+    const __m256i order_bits = _mm256_set1_epi32(order);
+    const __m256i transparent = _mm256_set1_epi32(LINE_TRANSPARENT);
+    for (int x = 0; x < count; x += 8)
+    {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + x)));
+        __m256i colours = _mm256_i32gather_epi32(reinterpret_cast<const int*>(palette), index, 2);
+        __m256i pixels = _mm256_or_si256(_mm256_and_si256(colours, colour_mask), order_bits);
+        pixels = _mm256_blendv_epi8(pixels, transparent, _mm256_cmpeq_epi32(index, _mm256_setzero_si256()));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), pixels);
+    }
+}
+#endif
+
+static void lookup_line_scalar(const std::uint8_t* indices, const std::uint16_t* palette, int count, std::uint32_t order, std::uint32_t* out)
+{
+    for (int x = 0; x < count; x++)
+    {
+        out[x] = indices[x] ? (order | (palette[indices[x]] & 0x7FFF)) : LINE_TRANSPARENT;
+    }
+}
+
+#ifndef COMPOSITOR_X86
+static void expand_line_scalar(const std::uint16_t* colours, int count, std::uint32_t order, std::uint32_t* out)
+{
+    for (int x = 0; x < count; x++)
+    {
+        out[x] = order | (colours[x] & 0x7FFF);
+    }
+}
+
+static void compose_line_scalar(const std::uint32_t* const* layers, int count, std::uint32_t backdrop, std::uint16_t* out)
+{
+    for (int x = 0; x < LINE_WIDTH; x++)
+    {
+        std::uint32_t front = backdrop;
+        for (int layer = 0; layer < count; layer++)
+        {
+            front = std::min(front, layers[layer][x]);
+        }
+        out[x] = front & 0x7FFF;
+    }
+}
+#endif
+
+#ifdef COMPOSITOR_X86
+static bool has_avx2()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+#endif
+
+void expand_line(const std::uint16_t* colours, int count, std::uint32_t order, std::uint32_t* out)
+{
+#ifdef COMPOSITOR_X86
+    expand_line_sse2(colours, count, order, out);
+#else
+    expand_line_scalar(colours, count, order, out);
+#endif
+}
+
+void lookup_line(const std::uint8_t* indices, const std::uint16_t* palette, int count, std::uint32_t order, std::uint32_t* out)
+{
+#ifdef COMPOSITOR_X86
+    if (has_avx2())
+    {
+        lookup_line_avx2(indices, palette, count, order, out);
+        return;
+    }
+#endif
+    lookup_line_scalar(indices, palette, count, order, out);
+}
+
+void compose_line(const std::uint32_t* const* layers, int count, std::uint32_t backdrop, std::uint16_t* out)
+{
+#ifdef COMPOSITOR_X86
+    if (has_avx2())
+    {
+        compose_line_avx2(layers, count, backdrop, out);
+        return;
+    }
+    compose_line_sse2(layers, count, backdrop, out);
+#else
+    compose_line_scalar(layers, count, backdrop, out);
+#endif
+}
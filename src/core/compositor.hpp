@@ -0,0 +1,34 @@
+#ifndef COMPOSITOR_HPP
+#define COMPOSITOR_HPP
+
+#include <array>
+#include <cstdint>
+
+static constexpr int LINE_WIDTH = 240;
+
+// A layer's pixels for one scanline. Bits 24-30 hold the draw order, priority * 8 + layer with
+// lower values in front, bits 16-23 flags for blending and bits 0-14 the colour. Keeping the
+// smallest value of each column across the layers leaves the front pixel, transparent pixels
+// are the largest positive value so signed compares work on every instruction set.
+using LineBuffer = std::array<std::uint32_t, LINE_WIDTH>;
+
+static constexpr int LINE_ORDER_SHIFT = 24;
+static constexpr std::uint32_t LINE_TRANSPARENT = 0x7FFFFFFF;
+//! set on pixels of semi-transparent objects
+static constexpr std::uint32_t LINE_SEMI_TRANSPARENT = 1 << 16;
+
+constexpr std::uint32_t line_pixel(std::uint32_t order, std::uint16_t colour) noexcept
+{
+    return (order << LINE_ORDER_SHIFT) | (colour & 0x7FFF);
+}
+
+//! count bitmap colours into out as pixels of the given order, count is a multiple of 8
+void expand_line(const std::uint16_t* colours, int count, std::uint32_t order, std::uint32_t* out);
+//! count palette indices into out as pixels of the given order, index 0 is transparent. count is a multiple of 8
+void lookup_line(const std::uint8_t* indices, const std::uint16_t* palette, int count, std::uint32_t order, std::uint32_t* out);
+
+//! merges count line buffers over a backdrop pixel into out with the widest vector unit the host has.
+//! blending and windows would keep the two front pixels of each column here instead of one
+void compose_line(const std::uint32_t* const* layers, int count, std::uint32_t backdrop, std::uint16_t* out);
+
+#endif
@@ -1,119 +1,126 @@
 #include "cpu.hpp"
 
 #include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <utility>
 #include <cassert>
 
 static const int CYCLES_PER_FRAME = 280896;
+static const int MAX_BLOCK_INSTRS = 64;
+static const int JIT_HOT_BLOCK_HITS = 16;
+static const int IDLE_LOOP_MAX_INSTRS = 8;
 
-CPU::CPU(const std::string& rom_filepath) : m_pipeline_invalid(false), m_mode(SYS)
+// per game overrides, one "<game code> on|off" line each, games without a line have skipping on
+static const char* IDLE_LOOP_SETTINGS_PATH = "roms/idle_loops.cfg";
+
+CPU::CPU(const std::string& rom_filepath) : m_pipeline_invalid(false), m_mode(SYS), m_block(nullptr), m_block_idx(0), m_block_next_event(0), m_jit_enabled(false), m_hle_bios(false),
+    m_idle_loop_skipping(true), m_idle_block(nullptr), m_idle_loops_skipped(0), m_idle_loop_polls_timer(false), m_frame_end(0),
+    m_stall_cycles(0), m_next_data_addr(0)
 {
     initialize_registers();
     m_mem.load_bios();
     m_mem.load_rom(rom_filepath);
-    m_pipeline = fetch_arm();
+    m_idle_loop_skipping = read_idle_loop_setting(m_mem.game_code());
+    m_regs[15] += 4;
 }
 
 void CPU::initialize_registers() 
 {
-    m_banked_regs[SYS].m_control = 0x1F;
-    m_banked_regs[SYS][13] = 0x03007F00;
-    m_banked_regs[SYS][14] = 0x08000000;
-    m_banked_regs[SYS][15] = 0x08000000;
-    m_banked_regs[SVC][13] = 0x03007FE0;
-    m_banked_regs[IRQ][13] = 0x03007FA0;
+    m_psrs[SYS].m_control = 0x1F;
+    m_regs[13] = 0x03007F00;
+    m_regs[14] = 0x08000000;
+    m_regs[15] = 0x08000000;
+    m_banked_sp_lr[SVC][0] = 0x03007FE0;
+    m_banked_sp_lr[IRQ][0] = 0x03007FA0;
 }
 
 bool CPU::in_user_mode()
 {
-    return (m_banked_regs[SYS].m_control & 0x1F) == 0b010000;
+    return (m_psrs[SYS].m_control & 0x1F) == 0b010000;
 }
 
 bool CPU::is_irq_disabled()
 {
-    return (m_banked_regs[SYS].m_control >> 7) & 1;
+    return (m_psrs[SYS].m_control >> 7) & 1;
 }
 
 bool CPU::is_thumb_enabled()
 {
-    return (m_banked_regs[SYS].m_control >> 5) & 1;
+    return (m_psrs[SYS].m_control >> 5) & 1;
 }
 
 void CPU::update_cpsr_thumb_status(bool is_enabled)
 {
-    m_banked_regs[SYS].m_control = (m_banked_regs[SYS].m_control & ~(1 << 5)) | (static_cast<std::uint8_t>(is_enabled) << 5);
+    m_psrs[SYS].m_control = (m_psrs[SYS].m_control & ~(1 << 5)) | (static_cast<std::uint8_t>(is_enabled) << 5);
 }
 
 void CPU::update_cpsr_irq_disable(bool is_disabled)
 {
-    m_banked_regs[SYS].m_control = (m_banked_regs[SYS].m_control & ~(1 << 7)) | (static_cast<std::uint8_t>(is_disabled) << 7);
+    m_psrs[SYS].m_control = (m_psrs[SYS].m_control & ~(1 << 7)) | (static_cast<std::uint8_t>(is_disabled) << 7);
+    m_mem.interrupts().set_cpu_disabled(is_disabled);
 }
 
 std::uint32_t CPU::get_psr()
 {
-    const auto& bank = m_banked_regs[m_mode];
-    std::uint8_t flags = (bank.m_flags.n << 3) | (bank.m_flags.z << 2) | (bank.m_flags.c << 1) | bank.m_flags.v;
-    return static_cast<std::uint32_t>(flags << 28) | bank.m_control;
+    materialize_flags();
+    const auto& psr = m_psrs[m_mode];
+    std::uint8_t flags = (psr.m_flags.n << 3) | (psr.m_flags.z << 2) | (psr.m_flags.c << 1) | psr.m_flags.v;
+    return static_cast<std::uint32_t>(flags << 28) | psr.m_control;
 }
 
 std::uint32_t CPU::get_cpsr()
 {
-    const auto& bank = m_banked_regs[SYS];
-    std::uint8_t flags = (bank.m_flags.n << 3) | (bank.m_flags.z << 2) | (bank.m_flags.c << 1) | bank.m_flags.v;
-    return static_cast<std::uint32_t>(flags << 28) | bank.m_control;
+    materialize_flags();
+    const auto& psr = m_psrs[SYS];
+    std::uint8_t flags = (psr.m_flags.n << 3) | (psr.m_flags.z << 2) | (psr.m_flags.c << 1) | psr.m_flags.v;
+    return static_cast<std::uint32_t>(flags << 28) | psr.m_control;
 }
 
 void CPU::bank_transfer(std::uint8_t mode_bits)
 {
-    m_banked_regs[SYS].m_control = (m_banked_regs[SYS].m_control & ~0x1F) | mode_bits;
-
-    for (int bank = 0; bank < m_banked_regs.size(); bank++)
-    {
-        for (int reg = 0; reg <= 7; reg++)
-        {
-            m_banked_regs[bank][reg] = m_banked_regs[m_mode][reg];
-        }
-        m_banked_regs[bank][15] = m_banked_regs[m_mode][15];
-    }
-
-    if (m_mode != FIQ)
-    {
-        for (int bank = 0; bank < m_banked_regs.size(); bank++)
-        {
-            if (bank != FIQ)
-            {
-                for (int reg = 8; reg <= 12; reg++)
-                {
-                    m_banked_regs[bank][reg] = m_banked_regs[m_mode][reg];
-                }
-            }
-        }
-    }
+    materialize_flags();
+    m_psrs[SYS].m_control = (m_psrs[SYS].m_control & ~0x1F) | mode_bits;
 
+    Mode mode = SYS;
     switch (mode_bits)
     {
     case 0b10000:
     case 0b11111:
-        m_mode = SYS;
+        mode = SYS;
         break;
     case 0b10001:
-        m_mode = FIQ;
+        mode = FIQ;
         break;
     case 0b10010:
-        m_mode = IRQ;
+        mode = IRQ;
         break;
     case 0b10011:
-        m_mode = SVC;
+        mode = SVC;
         break;
     case 0b10111:
-        m_mode = ABT;
+        mode = ABT;
         break;
     case 0b11011:
-        m_mode = UND;
+        mode = UND;
         break;
     default: std::unreachable();
     }
+    if (mode == m_mode) return;
+
+    // only r13/r14, and r8-r12 when entering or leaving FIQ, are banked
+    m_banked_sp_lr[m_mode] = {m_regs[13], m_regs[14]};
+    m_regs[13] = m_banked_sp_lr[mode][0];
+    m_regs[14] = m_banked_sp_lr[mode][1];
+    if ((m_mode == FIQ) != (mode == FIQ))
+    {
+        for (int reg = 8; reg <= 12; reg++)
+        {
+            std::swap(m_regs[reg], m_banked_fiq_regs[reg - 8]);
+        }
+    }
+    m_mode = mode;
 }
 
 std::uint32_t CPU::ror(std::uint32_t operand, std::size_t shift_amount) 
@@ -123,53 +130,38 @@ std::uint32_t CPU::ror(std::uint32_t operand, std::size_t shift_amount)
 
 void CPU::safe_reg_assign(std::uint8_t reg, std::uint32_t value) 
 {
-    m_banked_regs[m_mode][reg] = value;
+    m_regs[reg] = value;
 
     if (reg == 15)
     {
         m_pipeline_invalid = true;
-        m_banked_regs[m_mode][15] &= ~(0b01 | (0b10 * !is_thumb_enabled()));
+        m_regs[15] &= ~(0b01 | (0b10 * !is_thumb_enabled()));
     }
 }
 
 bool CPU::condition(std::uint32_t instr) 
 {
-    const auto& bank = m_banked_regs[m_mode];    
     switch ((instr >> 28) & 0xF) 
     {
-    case 0x0: return bank.m_flags.z;
-    case 0x1: return !bank.m_flags.z;
-    case 0x2: return bank.m_flags.c;
-    case 0x3: return !bank.m_flags.c;
-    case 0x4: return bank.m_flags.n;
-    case 0x5: return !bank.m_flags.n;
-    case 0x6: return bank.m_flags.v;
-    case 0x7: return !bank.m_flags.v;
-    case 0x8: return bank.m_flags.c & !bank.m_flags.z;
-    case 0x9: return !bank.m_flags.c | bank.m_flags.z;
-    case 0xA: return bank.m_flags.n == bank.m_flags.v;
-    case 0xB: return bank.m_flags.n ^ bank.m_flags.v;
-    case 0xC: return !bank.m_flags.z && (bank.m_flags.n == bank.m_flags.v);
-    case 0xD: return bank.m_flags.z || (bank.m_flags.n ^ bank.m_flags.v);
+    case 0x0: return flag_z();
+    case 0x1: return !flag_z();
+    case 0x2: return flag_c();
+    case 0x3: return !flag_c();
+    case 0x4: return flag_n();
+    case 0x5: return !flag_n();
+    case 0x6: return flag_v();
+    case 0x7: return !flag_v();
+    case 0x8: return flag_c() && !flag_z();
+    case 0x9: return !flag_c() || flag_z();
+    case 0xA: return flag_n() == flag_v();
+    case 0xB: return flag_n() != flag_v();
+    case 0xC: return !flag_z() && (flag_n() == flag_v());
+    case 0xD: return flag_z() || (flag_n() != flag_v());
     case 0xE: return true;
     default: std::unreachable();
     }
 }
 
-std::uint32_t CPU::fetch_arm() 
-{
-    auto instr = m_mem.read<std::uint32_t>(m_banked_regs[m_mode][15]);
-    m_banked_regs[m_mode][15] += 4;
-    return instr;
-}
-
-std::uint16_t CPU::fetch_thumb() 
-{
-    auto instr = m_mem.read<std::uint16_t>(m_banked_regs[m_mode][15]);
-    m_banked_regs[m_mode][15] += 2;
-    return instr;
-}
-
 void CPU::barrel_shifter(
     std::uint32_t& operand,
     bool& carry_out,
@@ -207,7 +199,7 @@ void CPU::barrel_shifter(
         if (reg_imm_shift && !shift_amount) 
         {
             carry_out = operand & 1;
-            operand = (static_cast<std::uint32_t>(m_banked_regs[m_mode].m_flags.c) << 31) | (operand >> 1);
+            operand = (static_cast<std::uint32_t>(flag_c()) << 31) | (operand >> 1);
         } 
         else 
         {
@@ -218,16 +210,16 @@ void CPU::barrel_shifter(
     }
 }
 
+template <bool Link>
 int CPU::branch(std::uint32_t instr) 
 {
-    bool bl = (instr >> 24) & 1;
-    if (bl) 
+    if constexpr (Link) 
     {
-        m_banked_regs[m_mode][14] = m_banked_regs[m_mode][15] - 4;
+        m_regs[14] = m_regs[15] - 4;
     }
 
     std::int32_t nn = ((static_cast<std::int32_t>((instr & 0xFFFFFF) << 8) >> 8) << 2) >> is_thumb_enabled();
-    m_banked_regs[m_mode][15] += nn;
+    m_regs[15] += nn;
     m_pipeline_invalid = true;
     return 1;
 }
@@ -235,33 +227,34 @@ int CPU::branch(std::uint32_t instr)
 int CPU::branch_ex(std::uint32_t instr) 
 {
     std::uint8_t rn = instr & 0xF;
-    update_cpsr_thumb_status(m_banked_regs[m_mode][rn] & 1);
-    m_banked_regs[m_mode][15] = m_banked_regs[m_mode][rn] & ~(0b1 | (!is_thumb_enabled() * 0b10));
+    update_cpsr_thumb_status(m_regs[rn] & 1);
+    m_regs[15] = m_regs[rn] & ~(0b1 | (!is_thumb_enabled() * 0b10));
     m_pipeline_invalid = true;
     return 1;
 }
 
+template <bool I, bool P, bool U, bool B, bool W, bool L, CPU::ShiftType Shift>
 int CPU::single_transfer(std::uint32_t instr) 
 {
-    bool i = (instr >> 25) & 1;
-    bool p = (instr >> 24) & 1;
-    bool u = (instr >> 23) & 1;
-    bool b = (instr >> 22) & 1;
-    bool w = (instr >> 21) & 1;
-    bool l = (instr >> 20) & 1;
+    if constexpr (L) internal_cycles(1);
+    constexpr bool i = I;
+    constexpr bool p = P;
+    constexpr bool u = U;
+    constexpr bool b = B;
+    constexpr bool w = W;
+    constexpr bool l = L;
     std::uint8_t rn = (instr >> 16) & 0xF;
     std::uint8_t rd = (instr >> 12) & 0xF;
     std::uint32_t offset = 0;
 
-    if (i) 
+    if constexpr (i) 
     {
         std::uint8_t rm = instr & 0xF;
-        std::uint32_t operand = m_banked_regs[m_mode][rm];
+        std::uint32_t operand = m_regs[rm];
         std::uint8_t shift_amount = (instr >> 7) & 0x1F;
-        ShiftType shift_type = static_cast<ShiftType>((instr >> 5) & 3);
 
         bool carry_out = false;
-        barrel_shifter(operand, carry_out, shift_type, shift_amount, true);
+        barrel_shifter(operand, carry_out, Shift, shift_amount, true);
         offset = operand;
     } 
     else 
@@ -270,48 +263,50 @@ int CPU::single_transfer(std::uint32_t instr)
     }
     offset *= (-1 + (u * 2));
 
-    std::uint32_t addr = m_banked_regs[m_mode][rn] + (p ? offset : 0);
+    std::uint32_t addr = m_regs[rn] + (p ? offset : 0);
     bool writeback = !p || (p && w);
 
     if (l) 
     {
-        safe_reg_assign(rd, b ? m_mem.read<std::uint8_t>(addr) : ror(m_mem.read<std::uint32_t>(addr), (addr & 0x3) * 8));
+        safe_reg_assign(rd, b ? bus_read<std::uint8_t>(addr) : ror(bus_read<std::uint32_t>(addr), (addr & 0x3) * 8));
     } 
     else 
     {
-        std::uint32_t value = m_banked_regs[m_mode][rd] + ((rd == 0xF) * 4);
+        std::uint32_t value = m_regs[rd] + ((rd == 0xF) * 4);
         if (b) 
         {
-            m_mem.write<std::uint8_t>(addr, value);
+            bus_write<std::uint8_t>(addr, value);
         } 
         else 
         {
-            m_mem.write<std::uint32_t>(addr, value);
+            bus_write<std::uint32_t>(addr, value);
         }
     }
 
     if (writeback && (!l || !(rn == rd))) 
     {
-        safe_reg_assign(rn, m_banked_regs[m_mode][rn] + (((rd == 0xF) * 4) + offset));
+        safe_reg_assign(rn, m_regs[rn] + (((rd == 0xF) * 4) + offset));
     }
     return 1;
 }
 
+template <bool P, bool U, bool I, bool W, bool L, std::uint8_t Opcode>
 int CPU::halfword_transfer(std::uint32_t instr) 
 {
-    bool p = (instr >> 24) & 1;
-    bool u = (instr >> 23) & 1;
-    bool i = (instr >> 22) & 1;
-    bool w = (instr >> 21) & 1;
-    bool l = (instr >> 20) & 1;
+    if constexpr (L) internal_cycles(1);
+    constexpr bool p = P;
+    constexpr bool u = U;
+    constexpr bool i = I;
+    constexpr bool w = W;
+    constexpr bool l = L;
     auto rn = (instr >> 16) & 0xF;
     auto rd = (instr >> 12) & 0xF;
 
     std::int32_t offset = (i ? ((((instr >> 8) & 0xF) << 4) | (instr & 0xF)) : 
-        m_banked_regs[m_mode][instr & 0xF]) * (-1 + (u * 2));
+        m_regs[instr & 0xF]) * (-1 + (u * 2));
 
-    auto opcode = (instr >> 5) & 0x3;
-    auto addr = m_banked_regs[m_mode][rn] + (p * offset);
+    constexpr auto opcode = Opcode;
+    auto addr = m_regs[rn] + (p * offset);
     bool writeback = (p && w) || !p;
 
     if (l) 
@@ -322,18 +317,18 @@ int CPU::halfword_transfer(std::uint32_t instr)
         case 1: 
         {
             safe_reg_assign(rd, misaligned_read ? 
-                ror(m_mem.read<std::uint16_t>(addr - 1), 8) : m_mem.read<std::uint16_t>(addr));
+                ror(bus_read<std::uint16_t>(addr - 1), 8) : bus_read<std::uint16_t>(addr));
             break;
         }
         case 2: 
         {
-            safe_reg_assign(rd, static_cast<std::int32_t>(static_cast<std::int8_t>(m_mem.read<std::uint8_t>(addr))));
+            safe_reg_assign(rd, static_cast<std::int32_t>(static_cast<std::int8_t>(bus_read<std::uint8_t>(addr))));
             break;
         }
         case 3: 
         {
-            std::uint32_t value = misaligned_read ? static_cast<std::int32_t>(static_cast<std::int8_t>(m_mem.read<std::uint8_t>(addr)))
-                : static_cast<std::int32_t>(static_cast<std::int16_t>(m_mem.read<std::uint16_t>(addr)));
+            std::uint32_t value = misaligned_read ? static_cast<std::int32_t>(static_cast<std::int8_t>(bus_read<std::uint8_t>(addr)))
+                : static_cast<std::int32_t>(static_cast<std::int16_t>(bus_read<std::uint16_t>(addr)));
             safe_reg_assign(rd, value);
             break;
         }
@@ -341,29 +336,31 @@ int CPU::halfword_transfer(std::uint32_t instr)
     } 
     else 
     {
-        m_mem.write<std::uint16_t>(addr, m_banked_regs[m_mode][rd]);
+        bus_write<std::uint16_t>(addr, m_regs[rd]);
     }
 
     if (writeback && (!l || !(rn == rd))) 
     {
-        safe_reg_assign(rn, m_banked_regs[m_mode][rn] + (offset + ((rn == 0xF) * 4)));
+        safe_reg_assign(rn, m_regs[rn] + (offset + ((rn == 0xF) * 4)));
     }
     return 1;
 }
 
+template <bool P, bool U, bool S, bool W, bool L>
 int CPU::block_transfer(std::uint32_t instr) 
 {
-    bool p = (instr >> 24) & 1;
-    bool u = (instr >> 23) & 1;
-    bool s = (instr >> 22) & 1;
-    bool w = (instr >> 21) & 1;
-    bool l = (instr >> 20) & 1;
+    if constexpr (L) internal_cycles(1);
+    constexpr bool p = P;
+    constexpr bool u = U;
+    constexpr bool s = S;
+    constexpr bool w = W;
+    constexpr bool l = L;
     std::uint8_t rn = (instr >> 16) & 0xF;
     std::uint16_t reg_list = instr & 0xFFFF;
 
     int first_transfer = __builtin_ffs(reg_list) - 1;
     int transfers = __builtin_popcount(reg_list);
-    std::uint32_t transfer_base_addr = m_banked_regs[m_mode][rn];
+    std::uint32_t transfer_base_addr = m_regs[rn];
     std::uint32_t direction = 4 - (!u * 8);
 
     std::uint8_t prev_mode = 0;
@@ -371,14 +368,15 @@ int CPU::block_transfer(std::uint32_t instr)
     {
         if (l && ((reg_list >> 15) & 1)) 
         {
-            m_banked_regs[SYS].m_flags = m_banked_regs[m_mode].m_flags;
-            update_cpsr_thumb_status((m_banked_regs[m_mode].m_control >> 5) & 1);
-            update_cpsr_irq_disable((m_banked_regs[m_mode].m_control >> 7) & 1);
-            bank_transfer(m_banked_regs[m_mode].m_control & 0x1F);
+            materialize_flags();
+            m_psrs[SYS].m_flags = m_psrs[m_mode].m_flags;
+            update_cpsr_thumb_status((m_psrs[m_mode].m_control >> 5) & 1);
+            update_cpsr_irq_disable((m_psrs[m_mode].m_control >> 7) & 1);
+            bank_transfer(m_psrs[m_mode].m_control & 0x1F);
         }
         else
         {
-            prev_mode = m_banked_regs[SYS].m_control & 0x1F;
+            prev_mode = m_psrs[SYS].m_control & 0x1F;
             bank_transfer(0b11111);
         }
     }
@@ -387,20 +385,20 @@ int CPU::block_transfer(std::uint32_t instr)
     {
         if (l) 
         {
-            m_banked_regs[m_mode][15] = m_mem.read<std::uint32_t>(transfer_base_addr);
+            m_regs[15] = bus_read<std::uint32_t>(transfer_base_addr);
             m_pipeline_invalid = true;
         } 
         else 
         {
             std::uint32_t addr = u ? transfer_base_addr + (p * 4) : ((transfer_base_addr + (16 * direction)) + (!p * 4));
-            m_mem.write<std::uint32_t>(addr, m_banked_regs[m_mode][15] + (4 >> is_thumb_enabled()));
+            bus_write<std::uint32_t>(addr, m_regs[15] + (4 >> is_thumb_enabled()));
         }
-        m_banked_regs[m_mode][rn] += (16 * direction);
+        m_regs[rn] += (16 * direction);
         return 1;
     } 
     else if (w) 
     {
-        m_banked_regs[m_mode][rn] += (transfers * direction);
+        m_regs[rn] += (transfers * direction);
     }
 
     int reg_start, reg_end, step;
@@ -423,7 +421,7 @@ int CPU::block_transfer(std::uint32_t instr)
             if ((reg_list >> i) & 1) 
             {
                 std::uint32_t addr = transfer_base_addr + (p * direction);
-                safe_reg_assign(i, m_mem.read<std::uint32_t>(addr));
+                safe_reg_assign(i, bus_read<std::uint32_t>(addr));
                 transfer_base_addr += direction;
             }
     } 
@@ -435,9 +433,9 @@ int CPU::block_transfer(std::uint32_t instr)
             {
                 std::uint32_t addr = transfer_base_addr + (p * direction);
                 if ((first_transfer == i) && (i == rn)) {
-                    m_mem.write<std::uint32_t>(addr, transfer_base_addr_copy);
+                    bus_write<std::uint32_t>(addr, transfer_base_addr_copy);
                 } else {
-                    m_mem.write<std::uint32_t>(addr, m_banked_regs[m_mode][i] + ((i == 0xF) * (4 >> is_thumb_enabled())));
+                    bus_write<std::uint32_t>(addr, m_regs[i] + ((i == 0xF) * (4 >> is_thumb_enabled())));
                 }
                 transfer_base_addr += direction;
             }
@@ -457,11 +455,11 @@ int CPU::mrs(std::uint32_t instr)
     bool psr = (instr >> 22) & 1;
     if (psr) 
     {
-        m_banked_regs[m_mode][rd] = get_psr();
+        m_regs[rd] = get_psr();
     } 
     else 
     {
-        m_banked_regs[m_mode][rd] = get_cpsr();
+        m_regs[rd] = get_cpsr();
     }
     return 1;
 }
@@ -476,18 +474,19 @@ int CPU::msr(std::uint32_t instr)
     std::uint8_t shift_amount = ((instr >> 8) & 0xF) * 2;
     auto imm = instr & 0xFF;
     
-    std::uint32_t operand = i ? ror(imm, shift_amount) : m_banked_regs[m_mode][instr & 0xF];
+    std::uint32_t operand = i ? ror(imm, shift_amount) : m_regs[instr & 0xF];
     std::uint32_t flags = operand & 0xFF000000;
     std::uint32_t control = operand & 0x000000FF;
+    materialize_flags();
 
     if (psr) 
     {
         if (f) 
         {
-            m_banked_regs[m_mode].m_flags.n = flags >> 31;
-            m_banked_regs[m_mode].m_flags.z = (flags >> 30) & 1;
-            m_banked_regs[m_mode].m_flags.c = (flags >> 29) & 1;
-            m_banked_regs[m_mode].m_flags.v = (flags >> 28) & 1;
+            m_psrs[m_mode].m_flags.n = flags >> 31;
+            m_psrs[m_mode].m_flags.z = (flags >> 30) & 1;
+            m_psrs[m_mode].m_flags.c = (flags >> 29) & 1;
+            m_psrs[m_mode].m_flags.v = (flags >> 28) & 1;
         }
         if (c && !in_user_mode())
         {
@@ -498,7 +497,7 @@ int CPU::msr(std::uint32_t instr)
             }
             else
             {
-                m_banked_regs[m_mode].m_control = control;
+                m_psrs[m_mode].m_control = control;
             }
         }
     }
@@ -506,10 +505,10 @@ int CPU::msr(std::uint32_t instr)
     {
         if (f)
         {
-            m_banked_regs[SYS].m_flags.n = flags >> 31;
-            m_banked_regs[SYS].m_flags.z = (flags >> 30) & 1;
-            m_banked_regs[SYS].m_flags.c = (flags >> 29) & 1;
-            m_banked_regs[SYS].m_flags.v = (flags >> 28) & 1;
+            m_psrs[SYS].m_flags.n = flags >> 31;
+            m_psrs[SYS].m_flags.z = (flags >> 30) & 1;
+            m_psrs[SYS].m_flags.c = (flags >> 29) & 1;
+            m_psrs[SYS].m_flags.v = (flags >> 28) & 1;
         }
         if (c && !in_user_mode()) 
         {
@@ -522,19 +521,31 @@ int CPU::msr(std::uint32_t instr)
 
 int CPU::swi(std::uint32_t instr)
 {
-    m_banked_regs[SVC][14] = m_banked_regs[m_mode][15] - (4 >> is_thumb_enabled());
-    m_banked_regs[SVC].m_flags = m_banked_regs[SYS].m_flags;
-    m_banked_regs[SVC].m_control = m_banked_regs[SYS].m_control;
+    if (m_hle_bios)
+    {
+        std::uint8_t number = is_thumb_enabled() ? (instr & 0xFF) : ((instr >> 16) & 0xFF);
+        if (int cycles = hle_swi(number))
+        {
+            return cycles;
+        }
+    }
+
+    materialize_flags();
+    std::uint32_t return_addr = m_regs[15] - (4 >> is_thumb_enabled());
+    m_psrs[SVC].m_flags = m_psrs[SYS].m_flags;
+    m_psrs[SVC].m_control = m_psrs[SYS].m_control;
     update_cpsr_thumb_status(false);
     update_cpsr_irq_disable(true);
     bank_transfer(0b10011);
-    m_banked_regs[m_mode][15] = 0x00000008;
+    m_regs[14] = return_addr;
+    m_regs[15] = 0x00000008;
     m_pipeline_invalid = true;
     return 1;
 }
 
 int CPU::swp(std::uint32_t instr) 
 {
+    internal_cycles(1);
     bool b = (instr >> 22) & 1;
     std::uint8_t rn = (instr >> 16) & 0xF;
     std::uint8_t rd = (instr >> 12) & 0xF;
@@ -542,14 +553,14 @@ int CPU::swp(std::uint32_t instr)
 
     if (b) 
     {
-        std::uint32_t value = m_mem.read<std::uint8_t>(m_banked_regs[m_mode][rn]);
-        m_mem.write<std::uint8_t>(m_banked_regs[m_mode][rn], m_banked_regs[m_mode][rm]);
+        std::uint32_t value = bus_read<std::uint8_t>(m_regs[rn]);
+        bus_write<std::uint8_t>(m_regs[rn], m_regs[rm]);
         safe_reg_assign(rd, value);
     } 
     else 
     {
-        std::uint32_t value = ror(m_mem.read<std::uint32_t>(m_banked_regs[m_mode][rn]), (m_banked_regs[m_mode][rn] & 0x3) * 8);
-        m_mem.write<std::uint32_t>(m_banked_regs[m_mode][rn], m_banked_regs[m_mode][rm]);
+        std::uint32_t value = ror(bus_read<std::uint32_t>(m_regs[rn]), (m_regs[rn] & 0x3) * 8);
+        bus_write<std::uint32_t>(m_regs[rn], m_regs[rm]);
         safe_reg_assign(rd, value);
     }
     return 1;
@@ -564,7 +575,7 @@ void CPU::get_alu_operands(
 {
     bool imm = (instr >> 25) & 1;
     auto rn = (instr >> 16) & 0xF;
-    op1 = m_banked_regs[m_mode][rn];
+    op1 = m_regs[rn];
 
     if (imm) 
     {
@@ -579,11 +590,11 @@ void CPU::get_alu_operands(
         ShiftType shift_type = static_cast<ShiftType>((instr >> 5) & 0x3);
         std::uint8_t rm = instr & 0xF;
 
-        op2 = m_banked_regs[m_mode][rm];
+        op2 = m_regs[rm];
         if (r) {
-            if (rn == 0xF) op1 = m_banked_regs[m_mode][15] + (4 >> is_thumb_enabled());
-            if (rm == 0xF) op2 = m_banked_regs[m_mode][15] + (4 >> is_thumb_enabled());
-            std::uint8_t shift_amount = m_banked_regs[m_mode][(instr >> 8) & 0xF] & 0xFF;
+            if (rn == 0xF) op1 = m_regs[15] + (4 >> is_thumb_enabled());
+            if (rm == 0xF) op2 = m_regs[15] + (4 >> is_thumb_enabled());
+            std::uint8_t shift_amount = m_regs[(instr >> 8) & 0xF] & 0xFF;
             if (shift_amount) 
                 barrel_shifter(op2, carry_out, shift_type, shift_amount, false);
         } else {
@@ -593,181 +604,142 @@ void CPU::get_alu_operands(
     }
 }
 
+template <bool Imm, CPU::ShiftType Shift, bool RegShift>
+void CPU::alu_operands(
+    std::uint32_t instr, 
+    std::uint32_t& op1, 
+    std::uint32_t& op2, 
+    bool& carry_out
+) 
+{
+    auto rn = (instr >> 16) & 0xF;
+    op1 = m_regs[rn];
+
+    if constexpr (Imm) 
+    {
+        std::uint8_t imm_shift = ((instr >> 8) & 0xF) * 2; 
+        op2 = instr & 0xFF;
+        if (imm_shift)
+            barrel_shifter(op2, carry_out, ShiftType::ROR, imm_shift, false);
+    } 
+    else 
+    {
+        std::uint8_t rm = instr & 0xF;
+
+        op2 = m_regs[rm];
+        if constexpr (RegShift) {
+            if (rn == 0xF) op1 = m_regs[15] + (4 >> is_thumb_enabled());
+            if (rm == 0xF) op2 = m_regs[15] + (4 >> is_thumb_enabled());
+            std::uint8_t shift_amount = m_regs[(instr >> 8) & 0xF] & 0xFF;
+            if (shift_amount) 
+                barrel_shifter(op2, carry_out, Shift, shift_amount, false);
+        } else {
+            std::uint8_t shift_amount = (instr >> 7) & 0x1F;
+            barrel_shifter(op2, carry_out, Shift, shift_amount, true);
+        }
+    }
+}
+
+template <bool Imm, std::uint8_t Opcode, bool SetCC, CPU::ShiftType Shift, bool RegShift>
 int CPU::alu(std::uint32_t instr) 
 {
-    bool set_cc = (instr >> 20) & 1;
+    if constexpr (RegShift) internal_cycles(1);
+    constexpr bool set_cc = SetCC;
     auto rd = (instr >> 12) & 0xF;
 
     std::uint32_t op1 = 0;
     std::uint32_t op2 = 0;
-    bool carry_out = m_banked_regs[m_mode].m_flags.c;
-    get_alu_operands(instr, op1, op2, carry_out);
+    // only the logical ops pass the shifter carry on, the others skip deriving C
+    constexpr bool logical = (Opcode <= 0x1) || (Opcode == 0x8) || (Opcode == 0x9) || (Opcode >= 0xC);
+    bool carry_out = false;
+    if constexpr (logical && SetCC)
+    {
+        carry_out = flag_c();
+    }
+    alu_operands<Imm, Shift, RegShift>(instr, op1, op2, carry_out);
 
     if ((rd == 15) && set_cc) 
     {
-        m_banked_regs[SYS].m_flags = m_banked_regs[m_mode].m_flags;
-        update_cpsr_thumb_status((m_banked_regs[m_mode].m_control >> 5) & 1);
-        update_cpsr_irq_disable((m_banked_regs[m_mode].m_control >> 7) & 1);
-        bank_transfer(m_banked_regs[m_mode].m_control & 0x1F);
+        materialize_flags();
+        m_psrs[SYS].m_flags = m_psrs[m_mode].m_flags;
+        update_cpsr_thumb_status((m_psrs[m_mode].m_control >> 5) & 1);
+        update_cpsr_irq_disable((m_psrs[m_mode].m_control >> 7) & 1);
+        bank_transfer(m_psrs[m_mode].m_control & 0x1F);
     }
 
-    switch ((instr >> 21) & 0xF) 
+    switch (Opcode) 
     {
     case 0x0: 
     {
         std::uint32_t result = op1 & op2;
-        if (set_cc) 
-        {
-            m_banked_regs[m_mode].m_flags.n = result >> 31;
-            m_banked_regs[m_mode].m_flags.z = !result;
-            m_banked_regs[m_mode].m_flags.c = carry_out;
-        }
+        if (set_cc) set_logical_flags(result, carry_out);
         safe_reg_assign(rd, result);
         break;
     }
     case 0x1: 
     {
         std::uint32_t result = op1 ^ op2;
-        if (set_cc) 
-        {
-            m_banked_regs[m_mode].m_flags.n = result >> 31;
-            m_banked_regs[m_mode].m_flags.z = !result;
-            m_banked_regs[m_mode].m_flags.c = carry_out;
-        }
+        if (set_cc) set_logical_flags(result, carry_out);
         safe_reg_assign(rd, result);
         break;
     }
-    case 0x3: // RSB
-    {
-        std::uint32_t temp = op1;
-        op1 = op2;
-        op2 = temp;
-    }
     case 0x2: // SUB
-    {
-        std::uint32_t result = op1 - op2;
-        if (set_cc) 
-        {
-            m_banked_regs[m_mode].m_flags.n = result >> 31;
-            m_banked_regs[m_mode].m_flags.z = !result;
-            m_banked_regs[m_mode].m_flags.c = op1 >= op2;
-            m_banked_regs[m_mode].m_flags.v = ((op1 >> 31) != (op2 >> 31)) && ((op1 >> 31) != (result >> 31));
-        }
-        safe_reg_assign(rd, result);
+        safe_reg_assign(rd, set_cc ? sub_with_flags(op1, op2, true) : (op1 - op2));
+        break;
+    case 0x3: // RSB
+        safe_reg_assign(rd, set_cc ? sub_with_flags(op2, op1, true) : (op2 - op1));
         break;
-    }
     case 0x4: // ADD
+        safe_reg_assign(rd, set_cc ? add_with_flags(op1, op2, false) : (op1 + op2));
+        break;
+    case 0x5: // ADC
     {
-        std::uint32_t result = op1 + op2;
-        if (set_cc) 
-        {
-            m_banked_regs[m_mode].m_flags.n = result >> 31;
-            m_banked_regs[m_mode].m_flags.z = result == 0;
-            m_banked_regs[m_mode].m_flags.c = ((op1 >> 31) + (op2 >> 31) > (result >> 31));
-            m_banked_regs[m_mode].m_flags.v = ((op1 >> 31) == (op2 >> 31)) && ((op1 >> 31) != (result >> 31));
-        }
-        safe_reg_assign(rd, result);
+        bool carry_in = flag_c();
+        safe_reg_assign(rd, set_cc ? add_with_flags(op1, op2, carry_in) : (op1 + op2 + carry_in));
         break;
     }
-    case 0x5: 
+    case 0x6: // SBC
     {
-        std::uint32_t result = op1 + op2 + m_banked_regs[m_mode].m_flags.c;
-        if (set_cc) 
-        {
-            m_banked_regs[m_mode].m_flags.n = result >> 31;
-            m_banked_regs[m_mode].m_flags.z = !result;
-            m_banked_regs[m_mode].m_flags.c = ((op1 >> 31) + (op2 >> 31) > (result >> 31));
-            m_banked_regs[m_mode].m_flags.v = ((op1 >> 31) == (op2 >> 31)) && ((op1 >> 31) != (result >> 31));
-        }
-        safe_reg_assign(rd, result);
+        bool carry_in = flag_c();
+        safe_reg_assign(rd, set_cc ? sub_with_flags(op1, op2, carry_in) : (op1 - op2 - !carry_in));
         break;
     }
     case 0x7: // RSC
     { 
-        std::uint32_t temp = op1;
-        op1 = op2;
-        op2 = temp;
-    }
-    case 0x6: 
-    {
-        std::uint32_t result = op1 - op2 - !m_banked_regs[m_mode].m_flags.c;
-        if (set_cc) 
-        {
-            m_banked_regs[m_mode].m_flags.n = result >> 31;
-            m_banked_regs[m_mode].m_flags.z = !result;
-            m_banked_regs[m_mode].m_flags.c = static_cast<std::uint64_t>(op1) >= (static_cast<std::uint64_t>(op2) + !m_banked_regs[m_mode].m_flags.c);
-            m_banked_regs[m_mode].m_flags.v = ((op1 >> 31) != (op2 >> 31)) && ((op1 >> 31) != (result >> 31));
-        }
-        safe_reg_assign(rd, result);
+        bool carry_in = flag_c();
+        safe_reg_assign(rd, set_cc ? sub_with_flags(op2, op1, carry_in) : (op2 - op1 - !carry_in));
         break;
     }
-    case 0x8: 
-    {
-        std::uint32_t result = op1 & op2;
-        m_banked_regs[m_mode].m_flags.n = result >> 31;
-        m_banked_regs[m_mode].m_flags.z = !result;
-        m_banked_regs[m_mode].m_flags.c = carry_out;
+    case 0x8: // TST
+        set_logical_flags(op1 & op2, carry_out);
         break;
-    }
     case 0x9: // TEQ
-    { 
-        std::uint32_t result = op1 ^ op2;
-        m_banked_regs[m_mode].m_flags.n = result >> 31;
-        m_banked_regs[m_mode].m_flags.z = !result;
-        m_banked_regs[m_mode].m_flags.c = carry_out;
+        set_logical_flags(op1 ^ op2, carry_out);
         break;
-    }
     case 0xA: // CMP
-    { 
-        std::uint32_t result = op1 - op2;
-        m_banked_regs[m_mode].m_flags.n = result >> 31;
-        m_banked_regs[m_mode].m_flags.z = result == 0;
-        m_banked_regs[m_mode].m_flags.c = op1 >= op2;
-        m_banked_regs[m_mode].m_flags.v = ((op1 >> 31) != (op2 >> 31)) && ((op1 >> 31) != (result >> 31));
+        sub_with_flags(op1, op2, true);
         break;
-    }
     case 0xB: // CMN
-    { 
-        std::uint32_t result = op1 + op2;
-        m_banked_regs[m_mode].m_flags.n = result >> 31;
-        m_banked_regs[m_mode].m_flags.z = !result;
-        m_banked_regs[m_mode].m_flags.c = ((op1 >> 31) + (op2 >> 31) > (result >> 31));
-        m_banked_regs[m_mode].m_flags.v = ((op1 >> 31) == (op2 >> 31)) && ((op1 >> 31) != (result >> 31));
+        add_with_flags(op1, op2, false);
         break;
-    }
     case 0xC: // ORR
     { 
         std::uint32_t result = op1 | op2;
-        if (set_cc) 
-        {
-            m_banked_regs[m_mode].m_flags.n = result >> 31;
-            m_banked_regs[m_mode].m_flags.z = !result;
-            m_banked_regs[m_mode].m_flags.c = carry_out;
-        }
+        if (set_cc) set_logical_flags(result, carry_out);
         safe_reg_assign(rd, result);
         break;
     }
     case 0xE: // BIC
     { 
         std::uint32_t result = op1 & ~op2;
-        if (set_cc) 
-        {
-            m_banked_regs[m_mode].m_flags.n = result >> 31;
-            m_banked_regs[m_mode].m_flags.z = !result;
-            m_banked_regs[m_mode].m_flags.c = carry_out;
-        } 
+        if (set_cc) set_logical_flags(result, carry_out);
         safe_reg_assign(rd, result);
         break;
     }
     case 0xF: // MVN
         op2 = ~op2;
     case 0xD: // MOV
-        if (set_cc) 
-        {
-            m_banked_regs[m_mode].m_flags.n = op2 >> 31;
-            m_banked_regs[m_mode].m_flags.z = !op2;
-            m_banked_regs[m_mode].m_flags.c = carry_out;
-        }
+        if (set_cc) set_logical_flags(op2, carry_out);
         safe_reg_assign(rd, op2);
         break;
     }
@@ -783,37 +755,44 @@ int CPU::mul(std::uint32_t instr)
     std::uint8_t rs = (instr >> 8) & 0xF;
     std::uint8_t rm = instr & 0xF;
 
-    switch ((instr >> 21) & 0xF) 
+    // multiplies are rare enough to write N and Z directly
+    if (s) materialize_flags();
+
+    // accumulating and long multiplies take one more cycle each, long accumulate two
+    std::uint8_t opcode = (instr >> 21) & 0xF;
+    internal_cycles(multiply_cycles(m_regs[rs], (opcode != 0x4) && (opcode != 0x5)) + (opcode & 1) + (opcode >= 0x4));
+
+    switch (opcode) 
     {
     case 0x0: 
     {
-        std::uint32_t result = m_banked_regs[m_mode][rm] * m_banked_regs[m_mode][rs];
+        std::uint32_t result = m_regs[rm] * m_regs[rs];
         if (s) 
         {
-            m_banked_regs[m_mode].m_flags.n = result >> 31;
-            m_banked_regs[m_mode].m_flags.z = !result;
+            m_psrs[m_mode].m_flags.n = result >> 31;
+            m_psrs[m_mode].m_flags.z = !result;
         }
         safe_reg_assign(rd, result);
         break;
     }
     case 0x1: 
     {
-        std::uint32_t result = (m_banked_regs[m_mode][rm] * m_banked_regs[m_mode][rs]) + m_banked_regs[m_mode][rn];
+        std::uint32_t result = (m_regs[rm] * m_regs[rs]) + m_regs[rn];
         if (s) 
         {
-            m_banked_regs[m_mode].m_flags.n = result >> 31;
-            m_banked_regs[m_mode].m_flags.z = !result;
+            m_psrs[m_mode].m_flags.n = result >> 31;
+            m_psrs[m_mode].m_flags.z = !result;
         }
         safe_reg_assign(rd, result);
         break;
     }
     case 0x4: 
     {
-        std::uint64_t result = static_cast<std::uint64_t>(m_banked_regs[m_mode][rm]) * m_banked_regs[m_mode][rs];
+        std::uint64_t result = static_cast<std::uint64_t>(m_regs[rm]) * m_regs[rs];
         if (s) 
         {
-            m_banked_regs[m_mode].m_flags.n = result >> 63;
-            m_banked_regs[m_mode].m_flags.z = !result;
+            m_psrs[m_mode].m_flags.n = result >> 63;
+            m_psrs[m_mode].m_flags.z = !result;
         }
         safe_reg_assign(rn, result);
         safe_reg_assign(rd, result >> 32);
@@ -821,12 +800,12 @@ int CPU::mul(std::uint32_t instr)
     }
     case 0x5: 
     {
-        std::uint64_t result = static_cast<std::uint64_t>(m_banked_regs[m_mode][rm]) * m_banked_regs[m_mode][rs] 
-            + ((static_cast<std::uint64_t>(m_banked_regs[m_mode][rd]) << 32) | m_banked_regs[m_mode][rn]);
+        std::uint64_t result = static_cast<std::uint64_t>(m_regs[rm]) * m_regs[rs] 
+            + ((static_cast<std::uint64_t>(m_regs[rd]) << 32) | m_regs[rn]);
         if (s) 
         {
-            m_banked_regs[m_mode].m_flags.n = result >> 63;
-            m_banked_regs[m_mode].m_flags.z = !result;
+            m_psrs[m_mode].m_flags.n = result >> 63;
+            m_psrs[m_mode].m_flags.z = !result;
         }
         safe_reg_assign(rn, result);
         safe_reg_assign(rd, result >> 32);
@@ -834,12 +813,12 @@ int CPU::mul(std::uint32_t instr)
     }
     case 0x6: 
     {
-        std::int64_t result = static_cast<std::int64_t>(static_cast<std::int32_t>(m_banked_regs[m_mode][rm])) 
-            * static_cast<std::int64_t>(static_cast<std::int32_t>(m_banked_regs[m_mode][rs]));
+        std::int64_t result = static_cast<std::int64_t>(static_cast<std::int32_t>(m_regs[rm])) 
+            * static_cast<std::int64_t>(static_cast<std::int32_t>(m_regs[rs]));
         if (s) 
         {
-            m_banked_regs[m_mode].m_flags.n = result >> 63;
-            m_banked_regs[m_mode].m_flags.z = !result;
+            m_psrs[m_mode].m_flags.n = result >> 63;
+            m_psrs[m_mode].m_flags.z = !result;
         }
         safe_reg_assign(rn, result);
         safe_reg_assign(rd, result >> 32);
@@ -847,13 +826,13 @@ int CPU::mul(std::uint32_t instr)
     }
     case 0x7: 
     {
-        std::int64_t result = static_cast<std::int64_t>(static_cast<std::int32_t>(m_banked_regs[m_mode][rm])) 
-            * static_cast<std::int64_t>(static_cast<std::int32_t>(m_banked_regs[m_mode][rs]))
-                + (static_cast<std::int64_t>((static_cast<std::uint64_t>(m_banked_regs[m_mode][rd]) << 32) ) | m_banked_regs[m_mode][rn]);
+        std::int64_t result = static_cast<std::int64_t>(static_cast<std::int32_t>(m_regs[rm])) 
+            * static_cast<std::int64_t>(static_cast<std::int32_t>(m_regs[rs]))
+                + (static_cast<std::int64_t>((static_cast<std::uint64_t>(m_regs[rd]) << 32) ) | m_regs[rn]);
         if (s) 
         {
-            m_banked_regs[m_mode].m_flags.n = result >> 63;
-            m_banked_regs[m_mode].m_flags.z = !result;
+            m_psrs[m_mode].m_flags.n = result >> 63;
+            m_psrs[m_mode].m_flags.z = !result;
         }
         safe_reg_assign(rn, result);
         safe_reg_assign(rd, result >> 32);
@@ -864,192 +843,521 @@ int CPU::mul(std::uint32_t instr)
     return 1;
 }
 
-int CPU::execute()
+int CPU::multiply_cycles(std::uint32_t multiplier, bool sign_extends)
 {
-    if (is_thumb_enabled())
+    // the multiplier array stops once the remaining bits are all zeros, or all ones for signed operands
+    for (int cycles = 1; cycles < 4; cycles++)
     {
-        std::uint16_t instr = m_pipeline;
-        m_pipeline = fetch_thumb();
-
-        if (m_mem.pending_interrupts() && !is_irq_disabled())
+        std::uint32_t upper = multiplier & (0xFFFFFFFF << (8 * cycles));
+        if ((upper == 0) || (sign_extends && (upper == (0xFFFFFFFF << (8 * cycles)))))
         {
-            m_banked_regs[IRQ][14] = m_banked_regs[m_mode][15];
-            m_banked_regs[IRQ].m_control = m_banked_regs[SYS].m_control;
-            m_banked_regs[IRQ].m_flags = m_banked_regs[SYS].m_flags;
-            update_cpsr_irq_disable(true);
-            update_cpsr_thumb_status(false);
-            bank_transfer(0b10010);
-            m_banked_regs[m_mode][15] = 0x00000018;
-            m_pipeline_invalid = true;
-            return 1;
+            return cycles;
         }
+    }
+    return 4;
+}
 
-        switch (m_thumb_lut[instr >> 6]) 
-        {
-        case InstrFormat::THUMB_1: return alu(thumb_translate_1(instr));
-        case InstrFormat::THUMB_2: return alu(thumb_translate_2(instr));
-        case InstrFormat::THUMB_3: return alu(thumb_translate_3(instr));
-        case InstrFormat::THUMB_4: 
-        {
-            std::uint32_t translation = 0b11100000000100000000000000000000;
-            std::uint32_t rd = instr & 0x7;
-            std::uint32_t rs = (instr >> 3) & 0x7;
-            std::uint32_t arm_opcode = (instr >> 6) & 0xF;
-            ShiftType shift_type = ShiftType::LSL;
+int CPU::nop(std::uint32_t)
+{
+    return 1;
+}
 
-            translation |= (rd << 12);
+template <std::uint16_t Index>
+constexpr CPU::Handler CPU::arm_handler()
+{
+    constexpr bool p = (Index >> 8) & 1;
+    constexpr bool u = (Index >> 7) & 1;
+    constexpr bool w = (Index >> 5) & 1;
+    constexpr bool l = (Index >> 4) & 1;
+    constexpr auto shift_type = static_cast<ShiftType>((Index >> 1) & 0x3);
 
-            switch ((instr >> 6) & 0xF) 
-            {
-            case 0x2:
-                goto thumb_shift_instr;
-            case 0x3:
-                shift_type = ShiftType::LSR;
-                goto thumb_shift_instr;
-            case 0x4:
-                shift_type = ShiftType::ASR;
-                goto thumb_shift_instr;
-            case 0x7:
-                shift_type = ShiftType::ROR;
-                goto thumb_shift_instr;
-            case 0x9:
-                translation |= (0x3 << 21);
-                translation |= (0x1 << 25);
-                translation |= (rs << 16);
-                return alu(translation);
-            case 0xD:
-                translation |= (rd << 16);
-                translation |= rs;
-                translation |= (rd << 8);
-                return mul(translation);
-            }
+    if constexpr (m_arm_formats[Index] == InstrFormat::ALU)
+    {
+        constexpr bool imm = (Index >> 9) & 1;
+        constexpr std::uint8_t opcode = (Index >> 5) & 0xF;
+        if constexpr (imm) return &CPU::alu<true, opcode, l, ShiftType::LSL, false>;
+        else return &CPU::alu<false, opcode, l, shift_type, Index & 1>;
+    }
+    else if constexpr (m_arm_formats[Index] == InstrFormat::SINGLE_TRANSFER)
+    {
+        constexpr bool reg_offset = (Index >> 9) & 1;
+        constexpr bool b = (Index >> 6) & 1;
+        return &CPU::single_transfer<reg_offset, p, u, b, w, l, reg_offset ? shift_type : ShiftType::LSL>;
+    }
+    else if constexpr (m_arm_formats[Index] == InstrFormat::HALFWORD_TRANSFER)
+    {
+        constexpr bool imm = (Index >> 6) & 1;
+        return &CPU::halfword_transfer<p, u, imm, w, l, (Index >> 1) & 0x3>;
+    }
+    else if constexpr (m_arm_formats[Index] == InstrFormat::BLOCK_TRANSFER)
+    {
+        constexpr bool s = (Index >> 6) & 1;
+        return &CPU::block_transfer<p, u, s, w, l>;
+    }
+    else if constexpr (m_arm_formats[Index] == InstrFormat::B) return &CPU::branch<p>;
+    else if constexpr (m_arm_formats[Index] == InstrFormat::BX) return &CPU::branch_ex;
+    else if constexpr (m_arm_formats[Index] == InstrFormat::SWP) return &CPU::swp;
+    else if constexpr (m_arm_formats[Index] == InstrFormat::MRS) return &CPU::mrs;
+    else if constexpr (m_arm_formats[Index] == InstrFormat::SWI) return &CPU::swi;
+    else if constexpr (m_arm_formats[Index] == InstrFormat::MUL) return &CPU::mul;
+    else if constexpr (m_arm_formats[Index] == InstrFormat::MSR) return &CPU::msr;
+    else return &CPU::nop;
+}
 
-            translation |= rs;
+template <std::size_t... Indices>
+constexpr std::array<CPU::Handler, 4096> CPU::generate_arm_lut(std::index_sequence<Indices...>)
+{
+    return {arm_handler<Indices>()...};
+}
+
+const std::array<CPU::Handler, 4096> CPU::m_arm_lut = CPU::generate_arm_lut(std::make_index_sequence<4096>{});
 
-            complete_translation:
-                translation |= (arm_opcode << 21);
-                translation |= (rd << 16);
-                translation |= (static_cast<std::uint32_t>(std::to_underlying(shift_type)) << 5);
-                return alu(translation);
+DecodedInstr CPU::decode_arm(std::uint32_t instr, bool& ends_block)
+{
+    std::uint8_t rn = (instr >> 16) & 0xF;
+    std::uint8_t rd = (instr >> 12) & 0xF;
+    std::uint16_t opcode = arm_lut_index(instr);
+
+    ends_block = false;
+    switch (m_arm_formats[opcode]) 
+    {
+    case InstrFormat::B: 
+    case InstrFormat::BX: 
+    case InstrFormat::MSR: 
+    case InstrFormat::SWI: 
+        ends_block = true;
+        break;
+    case InstrFormat::SINGLE_TRANSFER: 
+    case InstrFormat::HALFWORD_TRANSFER: 
+    case InstrFormat::MUL: 
+        ends_block = (rd == 0xF) || (rn == 0xF);
+        break;
+    case InstrFormat::BLOCK_TRANSFER: 
+        // an empty list transfers r15 like a list of just r15
+        ends_block = ((instr >> 15) & 1) || !(instr & 0xFFFF) || ((instr >> 22) & 1) || (rn == 0xF);
+        break;
+    case InstrFormat::MRS: 
+    case InstrFormat::SWP: 
+    case InstrFormat::ALU: 
+        ends_block = rd == 0xF;
+        break;
+    default: 
+        break;
+    }
+    return {m_arm_lut[opcode], instr};
+}
 
-            thumb_shift_instr:
-                arm_opcode = 0xD;
-                translation |= (0x1 << 4);
-                translation |= (rs << 8);
-                translation |= rd;
-                goto complete_translation;
+Block CPU::compile_block(std::uint32_t pc, bool thumb)
+{
+    Block block;
+    block.start = pc;
 
-            std::unreachable();
+    std::uint32_t addr = pc;
+    bool ends_block = false;
+    while (!ends_block && (block.instrs.size() < MAX_BLOCK_INSTRS))
+    {
+        if (thumb)
+        {
+            block.instrs.push_back(decode_thumb(m_mem.read<std::uint16_t>(addr), ends_block));
+            addr += 2;
         }
-        case InstrFormat::THUMB_5_ALU: return alu(thumb_translate_5_alu(instr));
-        case InstrFormat::THUMB_5_BX: return branch_ex(thumb_translate_5_bx(instr));
-        case InstrFormat::THUMB_6: 
+        else
         {
-            std::uint8_t rd = (instr >> 8) & 0x7;
-            std::uint16_t nn = (instr & 0xFF) << 2;
-            m_banked_regs[m_mode][rd] = m_mem.read<std::uint32_t>((m_banked_regs[m_mode][15] & ~2) + nn);
-            return 1;
+            block.instrs.push_back(decode_arm(m_mem.read<std::uint32_t>(addr), ends_block));
+            addr += 4;
         }
-        case InstrFormat::THUMB_7: return single_transfer(thumb_translate_7(instr));
-        case InstrFormat::THUMB_8: return halfword_transfer(thumb_translate_8(instr));
-        case InstrFormat::THUMB_9: return single_transfer(thumb_translate_9(instr));
-        case InstrFormat::THUMB_10: return halfword_transfer(thumb_translate_10(instr));
-        case InstrFormat::THUMB_11: return single_transfer(thumb_translate_11(instr));
-        case InstrFormat::THUMB_12: 
+    }
+    block.end = addr;
+    block.idle_loop = is_idle_loop(block, thumb);
+    return block;
+}
+
+bool CPU::idle_loop_operands(std::uint32_t instr, bool thumb, IdleLoopOperands& operands)
+{
+    if (thumb)
+    {
+        std::uint8_t rd = instr & 0x7;
+        std::uint8_t rs = (instr >> 3) & 0x7;
+        std::uint8_t rn = (instr >> 6) & 0x7;
+        bool load = (instr >> 11) & 1;
+        switch (m_thumb_lut[instr >> 6])
         {
-            std::uint8_t rd = (instr >> 8) & 0x7;
-            std::uint32_t nn = (instr & 0xFF) << 2;
-            if ((instr >> 11) & 1) 
-            {
-                m_banked_regs[m_mode][rd] = m_banked_regs[m_mode][13] + nn;
-            }
-            else 
-            {
-                m_banked_regs[m_mode][rd] = (m_banked_regs[m_mode][15] & ~2) + nn;
-            }
-            return 1;
+        case InstrFormat::THUMB_1:
+            operands = {static_cast<std::uint16_t>(1 << rs), static_cast<std::uint16_t>(1 << rd), true, false};
+            return true;
+        case InstrFormat::THUMB_2:
+        {
+            bool imm = (instr >> 10) & 1;
+            operands = {static_cast<std::uint16_t>((1 << rs) | (!imm << rn)), static_cast<std::uint16_t>(1 << rd), true, true};
+            return true;
         }
-        case InstrFormat::THUMB_13: return alu(thumb_translate_13(instr));
-        case InstrFormat::THUMB_14: return block_transfer(thumb_translate_14(instr));
-        case InstrFormat::THUMB_15: return block_transfer(thumb_translate_15(instr));
-        case InstrFormat::THUMB_16: 
+        case InstrFormat::THUMB_3:
         {
-            std::uint32_t arm_instr = thumb_translate_16(instr);
-            if (condition(arm_instr)) 
-            {
-                return branch(arm_instr);
-            }
-            return 1;
+            std::uint8_t opcode = (instr >> 11) & 0x3;
+            std::uint8_t reg = (instr >> 8) & 0x7;
+            operands = {static_cast<std::uint16_t>((opcode != 0) << reg), static_cast<std::uint16_t>((opcode != 1) << reg), true, opcode != 0};
+            return true;
         }
-        case InstrFormat::THUMB_17: return swi(thumb_translate_17(instr));
-        case InstrFormat::THUMB_18: return branch(thumb_translate_18(instr));
-        case InstrFormat::THUMB_19_PREFIX: 
+        case InstrFormat::THUMB_4:
         {
-            std::uint32_t upper_half_offset = static_cast<std::int32_t>((instr & 0x7FF) << 21) >> 21;
-            m_banked_regs[m_mode][14] = m_banked_regs[m_mode][15] + (upper_half_offset << 12);
-            return 1;
+            std::uint8_t opcode = (instr >> 6) & 0xF;
+            if ((opcode == 0x5) || (opcode == 0x6)) return false; // ADC and SBC read the previous carry
+            bool reads_rd = (opcode != 0x9) && (opcode != 0xF);
+            bool writes_rd = (opcode != 0x8) && (opcode != 0xA) && (opcode != 0xB);
+            operands = {static_cast<std::uint16_t>((1 << rs) | (reads_rd << rd)), static_cast<std::uint16_t>(writes_rd << rd), 
+                true, (opcode >= 0x9) && (opcode <= 0xB)};
+            return true;
         }
-        case InstrFormat::THUMB_19_SUFFIX: 
+        case InstrFormat::THUMB_5_ALU:
         {
-            std::uint32_t lower_half_offset = instr & 0x7FF;
-            std::uint32_t curr_pc = m_banked_regs[m_mode][15];
-            m_banked_regs[m_mode][15] = m_banked_regs[m_mode][14] + (lower_half_offset << 1);
-            m_banked_regs[m_mode][14] = (curr_pc - 2) | 1;
-            m_pipeline_invalid = true;
-            return 1;
+            std::uint8_t opcode = (instr >> 8) & 0x3;
+            std::uint8_t hd = rd | ((instr >> 4) & 0x8);
+            std::uint8_t hs = (instr >> 3) & 0xF;
+            if (hd == 15) return false;
+            operands = {static_cast<std::uint16_t>((1 << hs) | ((opcode != 2) << hd)), static_cast<std::uint16_t>((opcode != 1) << hd), 
+                opcode == 1, opcode == 1};
+            return true;
         }
-        case InstrFormat::NOP: return 1;
-        default: std::unreachable();
+        case InstrFormat::THUMB_6:
+            operands = {1 << 15, static_cast<std::uint16_t>(1 << ((instr >> 8) & 0x7)), false, false};
+            return true;
+        case InstrFormat::THUMB_7:
+            operands = {static_cast<std::uint16_t>((1 << rs) | (1 << rn)), static_cast<std::uint16_t>(1 << rd), false, false};
+            return load;
+        case InstrFormat::THUMB_8:
+            operands = {static_cast<std::uint16_t>((1 << rs) | (1 << rn)), static_cast<std::uint16_t>(1 << rd), false, false};
+            return ((instr >> 10) & 0x3) != 0;
+        case InstrFormat::THUMB_9:
+        case InstrFormat::THUMB_10:
+            operands = {static_cast<std::uint16_t>(1 << rs), static_cast<std::uint16_t>(1 << rd), false, false};
+            return load;
+        case InstrFormat::THUMB_11:
+            operands = {1 << 13, static_cast<std::uint16_t>(1 << ((instr >> 8) & 0x7)), false, false};
+            return load;
+        default: return false;
+        }
+    }
+
+    std::uint8_t rn = (instr >> 16) & 0xF;
+    std::uint8_t rd = (instr >> 12) & 0xF;
+    std::uint8_t rm = instr & 0xF;
+    bool rrx = (((instr >> 4) & 0xFF) == 0x6);
+    if (((instr >> 28) != 0xE) || (rd == 15)) return false;
+
+    switch (m_arm_formats[arm_lut_index(instr)])
+    {
+    case InstrFormat::ALU:
+    {
+        std::uint8_t opcode = (instr >> 21) & 0xF;
+        bool imm = (instr >> 25) & 1;
+        bool reg_shift = !imm && ((instr >> 4) & 1);
+        if (((opcode >= 0x5) && (opcode <= 0x7)) || (!imm && rrx)) return false; // ADC, SBC, RSC and RRX read the previous carry
+
+        bool reads_rn = (opcode != 0xD) && (opcode != 0xF);
+        bool writes_rd = (opcode < 0x8) || (opcode > 0xB);
+        bool set_cc = (instr >> 20) & 1;
+        bool arithmetic = ((opcode >= 0x2) && (opcode <= 0x4)) || (opcode == 0xA) || (opcode == 0xB);
+        operands.reads = (reads_rn << rn) | (!imm << rm) | (reg_shift << ((instr >> 8) & 0xF));
+        operands.writes = writes_rd << rd;
+        operands.sets_flags = set_cc;
+        operands.sets_carry_overflow = set_cc && arithmetic;
+        return true;
+    }
+    case InstrFormat::SINGLE_TRANSFER:
+    {
+        // only pre-indexed loads without writeback
+        bool reg_offset = (instr >> 25) & 1;
+        if (!((instr >> 20) & 1) || !((instr >> 24) & 1) || ((instr >> 21) & 1) || (reg_offset && rrx)) return false;
+        operands = {static_cast<std::uint16_t>((1 << rn) | (reg_offset << rm)), static_cast<std::uint16_t>(1 << rd), false, false};
+        return true;
+    }
+    case InstrFormat::HALFWORD_TRANSFER:
+    {
+        bool reg_offset = !((instr >> 22) & 1);
+        if (!((instr >> 20) & 1) || !((instr >> 24) & 1) || ((instr >> 21) & 1)) return false;
+        operands = {static_cast<std::uint16_t>((1 << rn) | (reg_offset << rm)), static_cast<std::uint16_t>(1 << rd), false, false};
+        return true;
+    }
+    default: return false;
+    }
+}
+
+bool CPU::is_idle_loop(const Block& block, bool thumb)
+{
+    if (block.instrs.size() > IDLE_LOOP_MAX_INSTRS) return false;
+
+    // a register read before it is written would carry state from one iteration into the next
+    std::uint16_t written = 0;
+    std::uint16_t carried = 0;
+    bool flags_set = false;
+    bool carry_overflow_set = false;
+    for (std::size_t i = 0; i + 1 < block.instrs.size(); i++)
+    {
+        IdleLoopOperands operands;
+        if (!idle_loop_operands(block.instrs[i].instr, thumb, operands)) return false;
+
+        carried |= operands.reads & ~written;
+        written |= operands.writes;
+        if (operands.sets_flags)
+        {
+            flags_set = true;
+            carry_overflow_set = operands.sets_carry_overflow;
+        }
+    }
+    if (carried & written) return false;
+
+    std::uint32_t branch = block.instrs.back().instr;
+    std::uint32_t branch_addr = block.end - (4 >> thumb);
+    std::uint32_t target = 0;
+    std::uint8_t cond = 0xE;
+    if (thumb)
+    {
+        switch (m_thumb_lut[branch >> 6])
+        {
+        case InstrFormat::THUMB_16:
+            cond = (branch >> 8) & 0xF;
+            target = branch_addr + 4 + (static_cast<std::int8_t>(branch & 0xFF) * 2);
+            break;
+        case InstrFormat::THUMB_18:
+            target = branch_addr + 4 + ((static_cast<std::int32_t>(branch << 21) >> 21) * 2);
+            break;
+        default: return false;
         }
     }
     else
     {
-        std::uint32_t instr = m_pipeline;
-        m_pipeline = fetch_arm();
+        if ((m_arm_formats[arm_lut_index(branch)] != InstrFormat::B) || ((branch >> 24) & 1)) return false;
+        cond = branch >> 28;
+        target = branch_addr + 8 + ((static_cast<std::int32_t>(branch << 8) >> 8) * 4);
+    }
+    if (target != block.start) return false;
 
-        if (m_mem.pending_interrupts() && !is_irq_disabled())
+    // the exit condition has to be decided by flags of the current iteration
+    switch (cond)
+    {
+    case 0x0:
+    case 0x1:
+    case 0x4:
+    case 0x5: return flags_set;
+    case 0xE: return true;
+    case 0xF: return false;
+    default: return carry_overflow_set;
+    }
+}
+
+static bool valid_game_code(const std::string& game_code)
+{
+    return (game_code.size() == 4) && std::all_of(game_code.begin(), game_code.end(), [](char c) { return (c > ' ') && (c <= '~'); });
+}
+
+bool CPU::read_idle_loop_setting(const std::string& game_code)
+{
+    if (!valid_game_code(game_code)) return true;
+
+    std::ifstream settings(IDLE_LOOP_SETTINGS_PATH);
+    std::string code;
+    std::string value;
+    while (settings >> code >> value)
+    {
+        if (code == game_code) return value != "off";
+    }
+    return true;
+}
+
+void CPU::save_idle_loop_skipping()
+{
+    std::string game_code = m_mem.game_code();
+    if (!valid_game_code(game_code)) return;
+
+    std::ostringstream lines;
+    {
+        std::ifstream settings(IDLE_LOOP_SETTINGS_PATH);
+        std::string code;
+        std::string value;
+        while (settings >> code >> value)
         {
-            m_banked_regs[IRQ][14] = m_banked_regs[m_mode][15] - 4;
-            m_banked_regs[IRQ].m_control = m_banked_regs[SYS].m_control;
-            m_banked_regs[IRQ].m_flags = m_banked_regs[SYS].m_flags;
-            update_cpsr_irq_disable(true);
-            update_cpsr_thumb_status(false);
-            bank_transfer(0b10010);
-            m_banked_regs[m_mode][15] = 0x00000018;
-            m_pipeline_invalid = true;
-            return 1;
+            if (code != game_code) lines << code << " " << value << "\n";
         }
+    }
+    lines << game_code << (m_idle_loop_skipping ? " on" : " off") << "\n";
+    std::ofstream(IDLE_LOOP_SETTINGS_PATH) << lines.str();
+}
+
+int CPU::skip_idle_loop()
+{
+    // timer counters are worked out when read and move without any event, a loop polling one has to run
+    if (m_idle_loop_polls_timer) return 0;
+
+    // nothing the loop polls changes before the next event, unless an interrupt is taken first
+    std::uint64_t now = m_mem.cycles();
+    std::uint64_t target = std::min(m_mem.next_event(), m_frame_end);
+    if ((target <= now) || m_mem.irq_line()) return 0;
 
-        if (condition(instr)) [[likely]]
+    m_idle_block = nullptr;
+    m_idle_loops_skipped++;
+    return target - now;
+}
+
+Block& CPU::cache_block(std::uint32_t pc, bool thumb)
+{
+    switch ((pc >> 24) & 0xFF)
+    {
+    case 0x00:
+    case 0x08:
+    case 0x09:
+    case 0x0A:
+    case 0x0B:
+    case 0x0C:
+    case 0x0D: 
+        return m_block_cache.insert(pc, thumb, compile_block(pc, thumb));
+    case 0x02:
+    case 0x03:
+    {
+        Block& block = m_block_cache.insert(pc, thumb, compile_block(pc, thumb));
+        int last_page = -1;
+        for (std::uint32_t addr = block.start; addr < block.end; addr += 2)
         {
-            std::uint16_t opcode = (((instr >> 20) & 0xFF) << 4) | ((instr >> 4) & 0xF);
-            switch (m_arm_lut[opcode]) 
+            int page = m_mem.track_code(addr);
+            if (page != last_page)
             {
-            case InstrFormat::B: return branch(instr);
-            case InstrFormat::BX: return branch_ex(instr);
-            case InstrFormat::SINGLE_TRANSFER: return single_transfer(instr);
-            case InstrFormat::HALFWORD_TRANSFER: return halfword_transfer(instr);
-            case InstrFormat::BLOCK_TRANSFER: return block_transfer(instr);
-            case InstrFormat::MRS: return mrs(instr);
-            case InstrFormat::MSR: return msr(instr);
-            case InstrFormat::SWI: return swi(instr);
-            case InstrFormat::SWP: return swp(instr);
-            case InstrFormat::ALU: return alu(instr);
-            case InstrFormat::MUL: return mul(instr);
-            case InstrFormat::NOP: return 1;
-            default: std::unreachable();
+                m_block_cache.link_page(page, pc, thumb);
+                last_page = page;
+            }
+        }
+        return block;
+    }
+    default:
+        // code running out of vram or other odd regions is decoded on every visit
+        m_uncached_block = compile_block(pc, thumb);
+        m_uncached_block.instrs.resize(1);
+        m_uncached_block.end = pc + (4 >> thumb);
+        m_uncached_block.idle_loop = false;
+        return m_uncached_block;
+    }
+}
+
+CompiledBlock CPU::compiled_block(Block& block, bool thumb)
+{
+    if ((block.code == nullptr) && (++block.hits == JIT_HOT_BLOCK_HITS))
+    {
+        block.code = m_jit.compile(block, thumb);
+        if ((block.code == nullptr) && m_jit.exhausted())
+        {
+            m_jit.reset();
+            m_block_cache.drop_compiled_code();
+        }
+    }
+    return block.code;
+}
+
+void CPU::invalidate_blocks()
+{
+    for (auto page : m_mem.take_invalidated_code())
+    {
+        m_block_cache.invalidate_page(page);
+    }
+    m_block = nullptr;
+    m_idle_block = nullptr;
+}
+
+int CPU::execute()
+{
+    if (m_mem.has_invalidated_code()) [[unlikely]]
+    {
+        invalidate_blocks();
+    }
+
+    bool thumb = is_thumb_enabled();
+    if ((m_block == nullptr) || (m_block_idx == m_block->instrs.size()))
+    {
+        std::uint32_t pc = m_regs[15] - (4 >> thumb);
+        m_block = m_block_cache.lookup(pc, thumb);
+        if (m_block == nullptr) [[unlikely]]
+        {
+            m_block = &cache_block(pc, thumb);
+        }
+        m_block_idx = 0;
+
+        if (m_block->idle_loop && m_idle_loop_skipping) [[unlikely]]
+        {
+            if (m_block == m_idle_block)
+            {
+                if (int skipped = skip_idle_loop())
+                {
+                    return skipped;
+                }
             }
+            m_idle_block = m_block;
+            m_idle_loop_polls_timer = false;
         }
+        else
+        {
+            m_idle_block = nullptr;
+        }
+    }
+    const DecodedInstr& decoded = m_block->instrs[m_block_idx++];
+    m_regs[15] += 4 >> thumb;
+
+    if (m_mem.irq_line())
+    {
+        materialize_flags();
+        std::uint32_t return_addr = m_regs[15] - (!thumb * 4);
+        m_psrs[IRQ].m_control = m_psrs[SYS].m_control;
+        m_psrs[IRQ].m_flags = m_psrs[SYS].m_flags;
+        update_cpsr_irq_disable(true);
+        update_cpsr_thumb_status(false);
+        bank_transfer(0b10010);
+        m_regs[14] = return_addr;
+        m_regs[15] = 0x00000018;
+        m_pipeline_invalid = true;
         return 1;
     }
+
+    if (m_jit_enabled && (m_block_idx == 1) && (m_block != &m_uncached_block))
+    {
+        if (CompiledBlock code = compiled_block(*m_block, thumb))
+        {
+            // compiled code reads and writes the flag bytes directly
+            materialize_flags();
+            m_block_idx = m_block->instrs.size();
+            m_block_next_event = m_mem.next_event();
+            int cycles = code(this, &m_regs[0], reinterpret_cast<std::uint8_t*>(&m_psrs[m_mode].m_flags));
+            // a store with effects due before the next instruction leaves the block early with m_block_idx set to what ran
+            return cycles + fetch_cycles(m_block->start, thumb, m_block_idx);
+        }
+    }
+
+    int cycles = fetch_cycles(m_regs[15], thumb, 1);
+    m_next_data_addr = ~0u;
+    if (thumb || condition(decoded.instr)) [[likely]]
+    {
+        return cycles + (this->*decoded.handler)(decoded.instr);
+    }
+    return cycles + 1;
+}
+
+int CPU::fetch_cycles(std::uint32_t pc, bool thumb, std::size_t count)
+{
+    // handlers count one cycle per instruction, only the wait states on top of that are added here
+    int cycles = 0;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        cycles += m_mem.code_cycles(pc, thumb, true) - 1;
+    }
+    return cycles;
+}
+
+bool CPU::set_jit_enabled(bool enabled)
+{
+    m_jit_enabled = enabled && m_jit.available();
+    return m_jit_enabled == enabled;
 }
 
 void CPU::reset()
 {
     printf("reset\n");
     exit(1);
-    // m_banked_regs = std::array<Registers, 6>{};
-    // m_regs = m_banked_regs[SYS];
+    // m_regs = Registers{};
     // m_pipeline = 0;
     // m_pipeline_invalid = true;
     // is_thumb_enabled() = false;
@@ -1062,14 +1370,43 @@ FrameBuffer& CPU::view_current_frame()
     return m_mem.get_frame();
 }
 
+int CPU::halted_cycles()
+{
+    // nothing executes while halted, only an event can request the interrupt that wakes the cpu
+    std::uint64_t now = m_mem.cycles();
+    std::uint64_t target = m_mem.next_event();
+    if (m_frame_end > now)
+    {
+        target = std::min(target, m_frame_end);
+    }
+    return target - now;
+}
+
 int CPU::step()
 {
+    if (m_mem.halted()) [[unlikely]]
+    {
+        if (!m_mem.interrupt_requested())
+        {
+            int cycles = halted_cycles();
+            m_mem.tick_components(cycles);
+            return cycles;
+        }
+        m_mem.wake();
+    }
+
     int cycles = execute();
     if (m_pipeline_invalid)
     {
         m_pipeline_invalid = false;
-        m_pipeline = is_thumb_enabled() ? fetch_thumb() : fetch_arm();
+        m_block = nullptr;
+        bool thumb = is_thumb_enabled();
+        m_regs[15] += 4 >> thumb;
+        // refilling the pipeline fetches the target and the instruction after it
+        std::uint32_t target = m_regs[15] - (4 >> thumb);
+        cycles += m_mem.code_cycles(target, thumb, false) + m_mem.code_cycles(m_regs[15], thumb, true);
     }
+    cycles += std::exchange(m_stall_cycles, 0);
     m_mem.tick_components(cycles);
     return cycles;
 }
@@ -1077,16 +1414,18 @@ int CPU::step()
 FrameBuffer& CPU::render_frame(std::uint16_t key_input, std::uint32_t breakpoint, bool& breakpoint_reached) 
 {
     m_mem.update_key_input(key_input);
+    m_frame_end = m_mem.cycles() + CYCLES_PER_FRAME;
 
-    int total_cycles = 0;
-    while (total_cycles < CYCLES_PER_FRAME) 
+    // dma stalls advance the clock on top of what step returns
+    while (m_mem.cycles() < m_frame_end) 
     {
-        if (breakpoint == m_banked_regs[m_mode][15]) [[unlikely]] 
+        if (breakpoint == m_regs[15]) [[unlikely]] 
         {
             breakpoint_reached = true;
             break;
         }
-        total_cycles += step();
+        step();
     }
+    m_mem.flush_backup();
     return m_mem.get_frame();
 }
@@ -2,9 +2,12 @@
 #define CPU_HPP
 
 #include <string>
+#include <utility>
 #include <unordered_map>
 #include <map>
 
+#include "block_cache.hpp"
+#include "jit.hpp"
 #include "memory.hpp"
 
 class Debugger;
@@ -23,19 +26,22 @@ class CPU
         class Registers 
         {
             public:
-                Registers() : m_control(0), m_list({}) {};
+                Registers() : m_list({}) {};
 
                 std::uint32_t& operator[](std::uint8_t reg) {
                     return m_list[reg];
                 }
 
-                Flags m_flags;
-                std::uint8_t m_control;
-
             private:
                 std::array<std::uint32_t, 16> m_list{};
         };
 
+        struct StatusRegister
+        {
+            Flags m_flags;
+            std::uint8_t m_control;
+        };
+
         CPU(const std::string& rom_filepath);
 
         FrameBuffer& render_frame(std::uint16_t key_input, std::uint32_t breakpoint, bool& breakpoint_reached);
@@ -43,7 +49,20 @@ class CPU
         int step();
         void reset();
 
+        //! switches between the interpreter and the recompiler, false if the host has no jit support
+        bool set_jit_enabled(bool enabled);
+        //! fast-forwards busy-wait loops to the next hardware event, on unless the game's setting turns it off
+        void set_idle_loop_skipping(bool enabled) noexcept { m_idle_loop_skipping = enabled; }
+        bool idle_loop_skipping() const noexcept { return m_idle_loop_skipping; }
+        //! stores the current idle loop skipping as the setting of the inserted game
+        void save_idle_loop_skipping();
+        //! services the common bios calls natively instead of running the bios rom
+        void set_hle_bios_enabled(bool enabled) noexcept { m_hle_bios = enabled; }
+        //! serves guest loads from a reserved host window, false if the window couldn't be mapped
+        bool set_fastmem_enabled(bool enabled) { return m_mem.set_fastmem_enabled(enabled); }
+
         friend class Debugger;
+        friend class Jit;
 
     private:
         enum Mode 
@@ -66,12 +85,146 @@ class CPU
             THUMB_19_PREFIX, THUMB_19_SUFFIX
         };
 
+        typedef int (CPU::*Handler)(std::uint32_t);
+
+        // registers and flags touched by an instruction of an idle loop candidate
+        struct IdleLoopOperands
+        {
+            std::uint16_t reads = 0;
+            std::uint16_t writes = 0;
+            bool sets_flags = false;
+            bool sets_carry_overflow = false;
+        };
+
+        // flag setting ops only record their inputs, N/Z/C/V of the active bank are derived when read
+        struct LazyFlags
+        {
+            enum class Op : std::uint8_t
+            {
+                NONE = 0, LOGICAL, ADD, SUB
+            };
+
+            Op op = Op::NONE;
+            bool carry = false; // shifter carry out for LOGICAL, carry in for ADD and SUB
+            std::uint32_t result = 0;
+            std::uint32_t op1 = 0;
+            std::uint32_t op2 = 0;
+        };
+
+        bool flag_n() const
+        {
+            return (m_lazy_flags.op == LazyFlags::Op::NONE) ? m_psrs[m_mode].m_flags.n : (m_lazy_flags.result >> 31);
+        }
+        bool flag_z() const
+        {
+            return (m_lazy_flags.op == LazyFlags::Op::NONE) ? m_psrs[m_mode].m_flags.z : (m_lazy_flags.result == 0);
+        }
+        bool flag_c() const
+        {
+            const auto& lazy = m_lazy_flags;
+            switch (lazy.op)
+            {
+            case LazyFlags::Op::LOGICAL: return lazy.carry;
+            case LazyFlags::Op::ADD: return (static_cast<std::uint64_t>(lazy.op1) + lazy.op2 + lazy.carry) >> 32;
+            case LazyFlags::Op::SUB: return static_cast<std::uint64_t>(lazy.op1) >= (static_cast<std::uint64_t>(lazy.op2) + !lazy.carry);
+            default: return m_psrs[m_mode].m_flags.c;
+            }
+        }
+        bool flag_v() const
+        {
+            const auto& lazy = m_lazy_flags;
+            switch (lazy.op)
+            {
+            case LazyFlags::Op::ADD: return (~(lazy.op1 ^ lazy.op2) & (lazy.op1 ^ lazy.result)) >> 31;
+            case LazyFlags::Op::SUB: return ((lazy.op1 ^ lazy.op2) & (lazy.op1 ^ lazy.result)) >> 31;
+            default: return m_psrs[m_mode].m_flags.v;
+            }
+        }
+
+        //! N and Z from the result, C from the shifter, V is left alone
+        void set_logical_flags(std::uint32_t result, bool carry)
+        {
+            if (m_lazy_flags.op >= LazyFlags::Op::ADD)
+            {
+                m_psrs[m_mode].m_flags.v = flag_v();
+            }
+            m_lazy_flags.op = LazyFlags::Op::LOGICAL;
+            m_lazy_flags.carry = carry;
+            m_lazy_flags.result = result;
+        }
+        std::uint32_t add_with_flags(std::uint32_t op1, std::uint32_t op2, bool carry_in)
+        {
+            std::uint32_t result = op1 + op2 + carry_in;
+            m_lazy_flags = {LazyFlags::Op::ADD, carry_in, result, op1, op2};
+            return result;
+        }
+        std::uint32_t sub_with_flags(std::uint32_t op1, std::uint32_t op2, bool carry_in)
+        {
+            std::uint32_t result = op1 - op2 - !carry_in;
+            m_lazy_flags = {LazyFlags::Op::SUB, carry_in, result, op1, op2};
+            return result;
+        }
+
+        //! writes pending flags into the active bank, needed before anything touches m_flags directly
+        void materialize_flags()
+        {
+            if (m_lazy_flags.op != LazyFlags::Op::NONE)
+            {
+                m_psrs[m_mode].m_flags = {flag_n(), flag_z(), flag_c(), flag_v()};
+                m_lazy_flags.op = LazyFlags::Op::NONE;
+            }
+        }
+
         bool condition(std::uint32_t instr);
 
-        std::uint32_t fetch_arm();
-        std::uint16_t fetch_thumb();
         int execute();
 
+        static constexpr std::uint16_t arm_lut_index(std::uint32_t instr) 
+        {
+            return (((instr >> 20) & 0xFF) << 4) | ((instr >> 4) & 0xF);
+        }
+        template <std::uint16_t Index> static constexpr Handler arm_handler();
+        template <std::size_t... Indices> static constexpr std::array<Handler, 4096> generate_arm_lut(std::index_sequence<Indices...>);
+
+        DecodedInstr decode_arm(std::uint32_t instr, bool& ends_block);
+        DecodedInstr decode_thumb(std::uint16_t instr, bool& ends_block);
+        Block compile_block(std::uint32_t pc, bool thumb);
+        Block& cache_block(std::uint32_t pc, bool thumb);
+        CompiledBlock compiled_block(Block& block, bool thumb);
+        void invalidate_blocks();
+
+        static bool idle_loop_operands(std::uint32_t instr, bool thumb, IdleLoopOperands& operands);
+        static bool is_idle_loop(const Block& block, bool thumb);
+        static bool read_idle_loop_setting(const std::string& game_code);
+        int skip_idle_loop();
+        int halted_cycles();
+
+        // data accesses of the running instruction, they are sequential when they continue the previous one
+        template <typename T>
+        T bus_read(std::uint32_t addr)
+        {
+            m_stall_cycles += m_mem.data_cycles<T>(addr, addr == m_next_data_addr);
+            m_next_data_addr = addr + sizeof(T);
+            m_idle_loop_polls_timer |= (addr & ~0xF) == 0x04000100;
+            return m_mem.read<T>(addr);
+        }
+
+        template <typename T>
+        void bus_write(std::uint32_t addr, T value)
+        {
+            m_stall_cycles += m_mem.data_cycles<T>(addr, addr == m_next_data_addr);
+            m_next_data_addr = addr + sizeof(T);
+            m_mem.write<T>(addr, value);
+        }
+
+        void internal_cycles(int cycles)
+        {
+            m_stall_cycles += cycles;
+            m_mem.prefetch_idle(cycles);
+        }
+        static int multiply_cycles(std::uint32_t multiplier, bool sign_extends);
+        int fetch_cycles(std::uint32_t pc, bool thumb, std::size_t count);
+
         void barrel_shifter(
             std::uint32_t& op,
             bool& carry_out,
@@ -80,6 +233,14 @@ class CPU
             bool reg_imm_shift
         );
 
+        template <bool Imm, ShiftType Shift, bool RegShift>
+        void alu_operands(
+            std::uint32_t instr, 
+            std::uint32_t& op1, 
+            std::uint32_t& op2, 
+            bool& carry_out
+        );
+
         void get_alu_operands(
             std::uint32_t instr, 
             std::uint32_t& op1, 
@@ -87,34 +248,79 @@ class CPU
             bool& carry_out
         );
 
-        int branch(std::uint32_t instr);
-        int branch_ex(std::uint32_t instr);
+        template <bool I, bool P, bool U, bool B, bool W, bool L, ShiftType Shift>
         int single_transfer(std::uint32_t instr);
+        template <bool P, bool U, bool I, bool W, bool L, std::uint8_t Opcode>
         int halfword_transfer(std::uint32_t instr);
+        template <bool P, bool U, bool S, bool W, bool L>
         int block_transfer(std::uint32_t instr);
+        template <bool Imm, std::uint8_t Opcode, bool SetCC, ShiftType Shift, bool RegShift>
+        int alu(std::uint32_t instr);
+        template <bool Link>
+        int branch(std::uint32_t instr);
+        int branch_ex(std::uint32_t instr);
         int msr(std::uint32_t instr);
         int mrs(std::uint32_t instr);
         int swi(std::uint32_t instr);
         int swp(std::uint32_t instr);
-        int alu(std::uint32_t instr);
         int mul(std::uint32_t instr);
+        int nop(std::uint32_t instr);
 
-        std::uint32_t thumb_translate_1(std::uint16_t instr);
-        std::uint32_t thumb_translate_2(std::uint16_t instr);
-        std::uint32_t thumb_translate_3(std::uint16_t instr);
-        std::uint32_t thumb_translate_5_alu(std::uint16_t instr);
-        std::uint32_t thumb_translate_5_bx(std::uint16_t instr);
-        std::uint32_t thumb_translate_7(std::uint16_t instr);
-        std::uint32_t thumb_translate_8(std::uint16_t instr);
-        std::uint32_t thumb_translate_9(std::uint16_t instr);
-        std::uint32_t thumb_translate_10(std::uint16_t instr);
-        std::uint32_t thumb_translate_11(std::uint16_t instr);
-        std::uint32_t thumb_translate_13(std::uint16_t instr);
-        std::uint32_t thumb_translate_14(std::uint16_t instr);
-        std::uint32_t thumb_translate_15(std::uint16_t instr);
-        std::uint32_t thumb_translate_16(std::uint16_t instr);
-        std::uint32_t thumb_translate_17(std::uint16_t instr);
-        std::uint32_t thumb_translate_18(std::uint16_t instr);
+        template <ShiftType Shift> int thumb_move_shifted(std::uint32_t instr);
+        template <bool Imm, bool Sub> int thumb_add_subtract(std::uint32_t instr);
+        template <std::uint8_t Opcode> int thumb_immediate_op(std::uint32_t instr);
+        template <std::uint8_t Opcode> int thumb_alu_op(std::uint32_t instr);
+        template <std::uint8_t Opcode> int thumb_hi_reg_op(std::uint32_t instr);
+        int thumb_branch_ex(std::uint32_t instr);
+        int thumb_load_pc_relative(std::uint32_t instr);
+        template <bool Load, bool Byte> int thumb_transfer_reg_offset(std::uint32_t instr);
+        template <std::uint8_t Opcode> int thumb_transfer_sign_extended(std::uint32_t instr);
+        template <bool Load, bool Byte> int thumb_transfer_imm_offset(std::uint32_t instr);
+        template <bool Load> int thumb_transfer_halfword(std::uint32_t instr);
+        template <bool Load> int thumb_transfer_sp_relative(std::uint32_t instr);
+        template <bool Sp> int thumb_load_address(std::uint32_t instr);
+        int thumb_adjust_sp(std::uint32_t instr);
+        template <bool Pop, bool PcLr> int thumb_push_pop(std::uint32_t instr);
+        template <bool Load> int thumb_multiple_transfer(std::uint32_t instr);
+        template <std::uint8_t Cond> int thumb_cond_branch(std::uint32_t instr);
+        int thumb_branch(std::uint32_t instr);
+        int thumb_long_branch_prefix(std::uint32_t instr);
+        int thumb_long_branch_suffix(std::uint32_t instr);
+        template <std::uint8_t Cond> bool condition_passed() const;
+
+        // bios calls, return the cycles taken or 0 to leave the call to the bios rom
+        int hle_swi(std::uint8_t number);
+        int hle_div();
+        int hle_sqrt();
+        int hle_arctan();
+        int hle_cpu_set();
+        int hle_cpu_fast_set();
+        int hle_bg_affine_set();
+        int hle_obj_affine_set();
+        template <bool Vram> int hle_lz77_uncomp();
+        template <bool Vram> int hle_rl_uncomp();
+        int hle_huff_uncomp();
+        template <bool Vram> void hle_write_byte(std::uint32_t& dst, std::uint32_t& pending, int& shift, std::uint8_t value);
+
+        // ARM encodings of THUMB instructions, used by the disassembler and the recompiler
+        static bool translate_thumb_alu(std::uint16_t instr, std::uint32_t& translation);
+        static std::uint32_t thumb_translate_1(std::uint16_t instr);
+        static std::uint32_t thumb_translate_2(std::uint16_t instr);
+        static std::uint32_t thumb_translate_3(std::uint16_t instr);
+        static std::uint32_t thumb_translate_4(std::uint16_t instr);
+        static std::uint32_t thumb_translate_5_alu(std::uint16_t instr);
+        static std::uint32_t thumb_translate_5_bx(std::uint16_t instr);
+        static std::uint32_t thumb_translate_7(std::uint16_t instr);
+        static std::uint32_t thumb_translate_8(std::uint16_t instr);
+        static std::uint32_t thumb_translate_9(std::uint16_t instr);
+        static std::uint32_t thumb_translate_10(std::uint16_t instr);
+        static std::uint32_t thumb_translate_11(std::uint16_t instr);
+        static std::uint32_t thumb_translate_13(std::uint16_t instr);
+        static std::uint32_t thumb_translate_14(std::uint16_t instr);
+        static std::uint32_t thumb_translate_15(std::uint16_t instr);
+        static std::uint32_t thumb_translate_16(std::uint16_t instr);
+        static std::uint32_t thumb_translate_17(std::uint16_t instr);
+        static std::uint32_t thumb_translate_18(std::uint16_t instr);
 
         void initialize_registers();
         void safe_reg_assign(std::uint8_t reg, std::uint32_t value);
@@ -131,7 +337,7 @@ class CPU
 
         std::uint32_t ror(std::uint32_t operand, std::size_t shift_amount);
 
-        std::array<InstrFormat, 4096> m_arm_lut = ([]() constexpr -> auto {
+        static constexpr std::array<InstrFormat, 4096> m_arm_formats = ([]() constexpr -> auto {
             std::array<InstrFormat, 4096> lut{};
             {
                 std::uint16_t postfix = 0b1111 << 8;
@@ -218,7 +424,10 @@ class CPU
             return lut;
         })();
 
-        std::array<InstrFormat, 1024> m_thumb_lut = ([]() constexpr -> auto {
+        // handlers specialized on the I/P/U/B/W/L/S bits and shift type of each ARM encoding
+        static const std::array<Handler, 4096> m_arm_lut;
+
+        static constexpr std::array<InstrFormat, 1024> m_thumb_lut = ([]() constexpr -> auto {
             std::array<InstrFormat, 1024> lut{};
             {
                 std::uint16_t suffix = 0b11110 << 5;
@@ -378,10 +587,39 @@ class CPU
             return lut;
         })();
 
-        std::uint32_t m_pipeline;
         bool m_pipeline_invalid;
         Mode m_mode;
-        std::array<Registers, 6> m_banked_regs{};
+        Registers m_regs;
+        // r13/r14 of every mode, only meaningful for the modes that are not active
+        std::array<std::array<std::uint32_t, 2>, 6> m_banked_sp_lr{};
+        // r8-r12 of the FIQ bank, or of all other modes while FIQ is active
+        std::array<std::uint32_t, 5> m_banked_fiq_regs{};
+        // the cpsr in the SYS slot, mode flags and saved control bits in the rest
+        std::array<StatusRegister, 6> m_psrs{};
+        LazyFlags m_lazy_flags;
+
+        BlockCache m_block_cache;
+        Block* m_block;
+        std::size_t m_block_idx;
+        // next scheduled event when the compiled block was entered, stores that schedule an earlier one leave it
+        std::uint64_t m_block_next_event;
+        Block m_uncached_block;
+
+        Jit m_jit;
+        bool m_jit_enabled;
+        bool m_hle_bios;
+
+        bool m_idle_loop_skipping;
+        // idle loop that was entered last, skipping starts once it has looped back to itself
+        Block* m_idle_block;
+        std::uint64_t m_idle_loops_skipped;
+        // one of the loads since the idle loop was entered read TMxCNT
+        bool m_idle_loop_polls_timer;
+        std::uint64_t m_frame_end;
+
+        // data access and internal cycles of the running instruction on top of its fetch
+        int m_stall_cycles;
+        std::uint32_t m_next_data_addr;
         
         Memory m_mem;
 };
@@ -0,0 +1,223 @@
+#include "dma.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "memory.hpp"
+
+// sad and dad are 27 bits wide where the channel can't reach the game pak
+static const std::array<std::uint32_t, 4> SRC_MASKS = {0x07FFFFFF, 0x0FFFFFFF, 0x0FFFFFFF, 0x0FFFFFFF};
+static const std::array<std::uint32_t, 4> DST_MASKS = {0x07FFFFFF, 0x07FFFFFF, 0x07FFFFFF, 0x0FFFFFFF};
+
+void Dma::register_io(Io& io)
+{
+    for (int channel = 0; channel < 4; channel++)
+    {
+        std::uint32_t control_offset = REGS_BASE + (channel * REGS_SIZE) + 10;
+        io.on_write(control_offset, control_offset + 2, [](void* context, std::uint32_t offset, std::uint16_t value, std::uint16_t mask) {
+            auto* dma = static_cast<Dma*>(context);
+            Io::store(dma->m_mmio, offset, value, mask);
+            dma->control_written((offset - REGS_BASE) / REGS_SIZE);
+        }, this);
+    }
+}
+
+void Dma::control_written(int channel)
+{
+    bool enabled = control(channel) & ENABLE;
+    if (enabled && !m_channels[channel].enabled)
+    {
+        enable(channel);
+    }
+    else if (!enabled)
+    {
+        m_channels[channel].enabled = false;
+        m_pending &= ~(1 << channel);
+    }
+}
+
+void Dma::trigger(Timing timing, std::uint8_t mask)
+{
+    std::uint8_t triggered = 0;
+    for (int channel = 0; channel < 4; channel++)
+    {
+        auto channel_timing = static_cast<Timing>((control(channel) >> TIMING_SHIFT) & 3);
+        if (m_channels[channel].enabled && (channel_timing == timing) && ((mask >> channel) & 1))
+        {
+            triggered |= 1 << channel;
+        }
+    }
+    if (triggered == 0) return;
+
+    if (m_pending == 0)
+    {
+        m_scheduler.schedule(Scheduler::Event::DMA, m_scheduler.now());
+    }
+    m_pending |= triggered;
+}
+
+void Dma::stop_video_capture()
+{
+    if (static_cast<Timing>((control(3) >> TIMING_SHIFT) & 3) == Timing::SPECIAL)
+    {
+        m_channels[3].enabled = false;
+        control(3) &= ~ENABLE;
+    }
+}
+
+int Dma::run()
+{
+    int cycles = 0;
+    while (m_pending != 0)
+    {
+        int channel = std::countr_zero(m_pending);
+        m_pending &= ~(1 << channel);
+        if (m_channels[channel].enabled)
+        {
+            cycles += transfer(channel);
+        }
+    }
+    return cycles;
+}
+
+std::uint32_t Dma::unit_count(int channel) const noexcept
+{
+    std::uint16_t count = *reinterpret_cast<std::uint16_t*>(m_mmio + REGS_BASE + (channel * REGS_SIZE) + 8);
+    if (channel == 3)
+    {
+        return count ? count : 0x10000;
+    }
+    count &= 0x3FFF;
+    return count ? count : 0x4000;
+}
+
+void Dma::enable(int channel)
+{
+    const std::uint8_t* regs = m_mmio + REGS_BASE + (channel * REGS_SIZE);
+    Channel& state = m_channels[channel];
+    state.src = *reinterpret_cast<const std::uint32_t*>(regs) & SRC_MASKS[channel];
+    state.dst = *reinterpret_cast<const std::uint32_t*>(regs + 4) & DST_MASKS[channel];
+    state.count = unit_count(channel);
+    state.enabled = true;
+
+    if (static_cast<Timing>((control(channel) >> TIMING_SHIFT) & 3) == Timing::IMMEDIATE)
+    {
+        // the transfer starts two cycles after the enabling write
+        if (m_pending == 0)
+        {
+            m_scheduler.schedule(Scheduler::Event::DMA, m_scheduler.now() + 2);
+        }
+        m_pending |= 1 << channel;
+    }
+}
+
+int Dma::transfer(int channel)
+{
+    Channel& state = m_channels[channel];
+    std::uint16_t cnt = control(channel);
+    auto timing = static_cast<Timing>((cnt >> TIMING_SHIFT) & 3);
+    auto dst_control = static_cast<AddressControl>((cnt >> DEST_CONTROL_SHIFT) & 3);
+    auto src_control = static_cast<AddressControl>((cnt >> SRC_CONTROL_SHIFT) & 3);
+    bool word = cnt & WORD;
+    std::uint32_t count = state.count;
+
+    // sound fifo transfers are always four words into the fixed fifo address
+    bool fifo = (timing == Timing::SPECIAL) && ((channel == 1) || (channel == 2));
+    if (fifo)
+    {
+        word = true;
+        count = 4;
+        dst_control = FIXED;
+    }
+
+    if (m_mem.in_eeprom(state.src) || m_mem.in_eeprom(state.dst))
+    {
+        m_mem.backup().eeprom_transfer(count);
+    }
+
+    // the prohibited source setting increments like the reload setting does for the destination
+    int unit = word ? 4 : 2;
+    auto step = [unit](AddressControl address_control) {
+        switch (address_control)
+        {
+        case DECREMENT: return -unit;
+        case FIXED: return 0;
+        default: return unit;
+        }
+    };
+    int cycles = word ? transfer_units<std::uint32_t>(state.src, state.dst, count, step(src_control), step(dst_control))
+        : transfer_units<std::uint16_t>(state.src, state.dst, count, step(src_control), step(dst_control));
+
+    if (cnt & IRQ)
+    {
+        m_mem.interrupts().request(Interrupts::DMA0 << channel);
+    }
+
+    if ((cnt & REPEAT) && (timing != Timing::IMMEDIATE))
+    {
+        state.count = unit_count(channel);
+        if (dst_control == RELOAD)
+        {
+            state.dst = *reinterpret_cast<const std::uint32_t*>(m_mmio + REGS_BASE + (channel * REGS_SIZE) + 4) & DST_MASKS[channel];
+        }
+    }
+    else
+    {
+        state.enabled = false;
+        control(channel) &= ~ENABLE;
+    }
+    return cycles;
+}
+
+template <typename T>
+int Dma::transfer_units(std::uint32_t& src, std::uint32_t& dst, std::uint32_t count, int src_step, int dst_step)
+{
+    // two internal cycles, then a read and a write per unit, sequential after the first
+    int cycles = 2 + m_mem.access_cycles<T>(src, false) + m_mem.access_cycles<T>(dst, false)
+        + ((count - 1) * (m_mem.access_cycles<T>(src, true) + m_mem.access_cycles<T>(dst, true)));
+    std::uint32_t bytes = count * sizeof(T);
+
+    // incrementing copies and fills between plain memory don't need to go through the bus one unit at a time
+    if ((dst_step == static_cast<int>(sizeof(T))) && ((src_step == dst_step) || (src_step == 0)))
+    {
+        std::uint8_t* to = m_mem.host_range(dst & ~(sizeof(T) - 1), bytes, true);
+        const std::uint8_t* from = src_step ? m_mem.host_range(src & ~(sizeof(T) - 1), bytes, false) : nullptr;
+        if ((to != nullptr) && (from != nullptr) && ((from + bytes <= to) || (to + bytes <= from)))
+        {
+            std::memcpy(to, from, bytes);
+        }
+        else if ((to != nullptr) && (src_step == 0))
+        {
+            T value = m_mem.read<T>(src);
+            if (value == 0)
+            {
+                std::memset(to, 0, bytes);
+            }
+            else
+            {
+                std::fill_n(reinterpret_cast<T*>(to), count, value);
+            }
+        }
+        else
+        {
+            to = nullptr;
+        }
+
+        if (to != nullptr)
+        {
+            m_mem.range_written(dst & ~(sizeof(T) - 1), bytes);
+            src += src_step * count;
+            dst += bytes;
+            return cycles;
+        }
+    }
+
+    for (std::uint32_t i = 0; i < count; i++)
+    {
+        m_mem.write<T>(dst, m_mem.read<T>(src));
+        src += src_step;
+        dst += dst_step;
+    }
+    return cycles;
+}
@@ -0,0 +1,73 @@
+#ifndef DMA_HPP
+#define DMA_HPP
+
+#include <array>
+#include <cstdint>
+
+#include "io.hpp"
+#include "scheduler.hpp"
+
+class Memory;
+
+// The four dma channels. Control writes latch the transfer, triggers only mark channels pending
+// and the transfers run from a scheduler event with the cpu stalled for their duration.
+class Dma
+{
+    public:
+        enum class Timing : std::uint8_t
+        {
+            IMMEDIATE = 0, VBLANK, HBLANK, SPECIAL
+        };
+
+        Dma(Memory& mem, std::uint8_t* mmio, Scheduler& scheduler) : m_mem(mem), m_mmio(mmio), m_scheduler(scheduler) {}
+
+        //! control writes latch or stop a channel
+        void register_io(Io& io);
+        //! starts every enabled channel waiting on the timing, special only applies to the channels in mask
+        void trigger(Timing timing, std::uint8_t mask = 0xF);
+        //! video capture stops by itself at the end of the frame
+        void stop_video_capture();
+        //! runs the pending channels in priority order, returns the cycles the cpu was stalled for
+        int run();
+
+    private:
+        static constexpr std::uint32_t REGS_BASE = 0xB0;
+        static constexpr std::uint32_t REGS_SIZE = 12;
+
+        enum Control : std::uint16_t
+        {
+            DEST_CONTROL_SHIFT = 5, SRC_CONTROL_SHIFT = 7, REPEAT = 1 << 9, WORD = 1 << 10,
+            TIMING_SHIFT = 12, IRQ = 1 << 14, ENABLE = 1 << 15
+        };
+
+        enum AddressControl : std::uint8_t
+        {
+            INCREMENT = 0, DECREMENT, FIXED, RELOAD
+        };
+
+        // internal registers, latched when the channel is enabled
+        struct Channel
+        {
+            std::uint32_t src = 0;
+            std::uint32_t dst = 0;
+            std::uint32_t count = 0;
+            bool enabled = false;
+        };
+
+        std::uint16_t& control(int channel) const noexcept { return *reinterpret_cast<std::uint16_t*>(m_mmio + REGS_BASE + (channel * REGS_SIZE) + 10); }
+        void control_written(int channel);
+        std::uint32_t unit_count(int channel) const noexcept;
+        void enable(int channel);
+        int transfer(int channel);
+        template <typename T>
+        int transfer_units(std::uint32_t& src, std::uint32_t& dst, std::uint32_t count, int src_step, int dst_step);
+
+        Memory& m_mem;
+        std::uint8_t* m_mmio;
+        Scheduler& m_scheduler;
+        std::array<Channel, 4> m_channels;
+        //! channels triggered and waiting for the dma event
+        std::uint8_t m_pending = 0;
+};
+
+#endif
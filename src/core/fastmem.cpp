@@ -0,0 +1,139 @@
+#include "fastmem.hpp"
+
+#include <algorithm>
+
+#ifdef FASTMEM_SUPPORTED
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+static const std::size_t WINDOW_SIZE = 0x100000000;
+
+#ifdef FASTMEM_SUPPORTED
+// only one window takes faults at a time, the cpu owning it runs on the faulting thread
+static FastMem* s_active = nullptr;
+static struct sigaction s_previous_action;
+static bool s_handler_installed = false;
+#endif
+
+FastMem::FastMem(std::size_t storage_size, FaultHandler fault_handler, void* context)
+    : m_base(nullptr), m_storage(nullptr), m_storage_size(storage_size), m_fd(-1), m_fault_handler(fault_handler), m_context(context)
+{
+#ifdef FASTMEM_SUPPORTED
+    if (s_active != nullptr) return;
+
+    void* window = mmap(nullptr, WINDOW_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (window == MAP_FAILED) return;
+
+    m_fd = memfd_create("gba-memory", MFD_CLOEXEC);
+    void* storage = MAP_FAILED;
+    if ((m_fd >= 0) && (ftruncate(m_fd, storage_size) == 0))
+    {
+        storage = mmap(nullptr, storage_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    }
+
+    if (!s_handler_installed && (storage != MAP_FAILED))
+    {
+        struct sigaction action = {};
+        action.sa_sigaction = &FastMem::handle_fault;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        s_handler_installed = sigaction(SIGSEGV, &action, &s_previous_action) == 0;
+    }
+
+    if ((storage == MAP_FAILED) || !s_handler_installed)
+    {
+        if (storage != MAP_FAILED) munmap(storage, storage_size);
+        if (m_fd >= 0) close(m_fd);
+        m_fd = -1;
+        munmap(window, WINDOW_SIZE);
+        return;
+    }
+
+    m_base = static_cast<std::uint8_t*>(window);
+    m_storage = static_cast<std::uint8_t*>(storage);
+    s_active = this;
+#endif
+}
+
+FastMem::~FastMem()
+{
+#ifdef FASTMEM_SUPPORTED
+    if (m_base != nullptr)
+    {
+        s_active = nullptr;
+        munmap(m_base, WINDOW_SIZE);
+        munmap(m_storage, m_storage_size);
+        close(m_fd);
+    }
+#endif
+}
+
+bool FastMem::map(std::uint32_t start, std::uint32_t end, std::size_t offset, std::size_t size)
+{
+#ifdef FASTMEM_SUPPORTED
+    for (std::size_t addr = start; addr < end; addr += size)
+    {
+        std::size_t length = std::min<std::size_t>(size, end - addr);
+        void* mirror = mmap(m_base + addr, length, PROT_READ, MAP_SHARED | MAP_FIXED, m_fd, offset);
+        if (mirror == MAP_FAILED) return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool FastMem::map_file(std::uint32_t addr, int fd, std::size_t length)
+{
+#ifdef FASTMEM_SUPPORTED
+    return mmap(m_base + addr, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) != MAP_FAILED;
+#else
+    return false;
+#endif
+}
+
+#ifdef FASTMEM_SUPPORTED
+void FastMem::handle_fault(int signal, siginfo_t* info, void* context)
+{
+    auto* fault = static_cast<std::uint8_t*>(info->si_addr);
+    FastMem* fastmem = s_active;
+    if ((fastmem != nullptr) && (fault >= fastmem->m_base) && (fault < fastmem->m_base + WINDOW_SIZE))
+    {
+        greg_t* regs = static_cast<ucontext_t*>(context)->uc_mcontext.gregs;
+        const auto* rip = reinterpret_cast<const std::uint8_t*>(regs[REG_RIP]);
+
+        // the encodings emitted by FastMem::load, all (%rdi,%rsi,1) into eax
+        int size = 0;
+        int length = 0;
+        if ((rip[0] == 0x0F) && (rip[1] == 0xB6) && (rip[2] == 0x04) && (rip[3] == 0x37))
+        {
+            size = 1;
+            length = 4;
+        }
+        else if ((rip[0] == 0x0F) && (rip[1] == 0xB7) && (rip[2] == 0x04) && (rip[3] == 0x37))
+        {
+            size = 2;
+            length = 4;
+        }
+        else if ((rip[0] == 0x8B) && (rip[1] == 0x04) && (rip[2] == 0x37))
+        {
+            size = 4;
+            length = 3;
+        }
+
+        if (size != 0)
+        {
+            auto addr = static_cast<std::uint32_t>(fault - fastmem->m_base);
+            regs[REG_RAX] = fastmem->m_fault_handler(fastmem->m_context, addr, size);
+            regs[REG_RIP] += length;
+            return;
+        }
+    }
+
+    // not ours, put the previous handler back and let the access fault again
+    sigaction(signal, &s_previous_action, nullptr);
+    s_handler_installed = false;
+}
+#endif
@@ -0,0 +1,78 @@
+#ifndef FASTMEM_HPP
+#define FASTMEM_HPP
+
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define FASTMEM_SUPPORTED 1
+#endif
+
+// Guest address space laid out 1:1 in a reserved 4 GiB host range. Memory is backed by a memfd
+// so mirrors can be mapped as aliases of the same pages, everything left unmapped faults and
+// the SIGSEGV handler completes the load through the slow path.
+class FastMem
+{
+    public:
+        //! completes a faulting load of size bytes
+        using FaultHandler = std::uint32_t (*)(void* context, std::uint32_t addr, int size);
+
+        FastMem(std::size_t storage_size, FaultHandler fault_handler, void* context);
+        ~FastMem();
+
+        FastMem(const FastMem&) = delete;
+        FastMem& operator=(const FastMem&) = delete;
+
+        //! false when the address range, the memfd or the signal handler couldn't be set up
+        bool available() const noexcept { return m_base != nullptr; }
+
+        //! guest address 0 in the host range
+        const std::uint8_t* base() const noexcept { return m_base; }
+        //! writable view of the whole backing memfd
+        std::uint8_t* storage() const noexcept { return m_storage; }
+
+        //! maps size bytes of storage at offset read only over [start, end), repeating every size bytes
+        bool map(std::uint32_t start, std::uint32_t end, std::size_t offset, std::size_t size);
+        //! maps the first length bytes of a file read only at addr
+        bool map_file(std::uint32_t addr, int fd, std::size_t length);
+
+        //! a single host load, the fixed registers and encodings let the fault handler decode it
+        template <typename T>
+        static T load(const std::uint8_t* base, std::uint32_t addr)
+        {
+#ifdef FASTMEM_SUPPORTED
+            std::uint32_t value;
+            std::uint64_t offset = addr;
+            if constexpr (sizeof(T) == 1)
+            {
+                asm volatile("movzbl (%%rdi,%%rsi,1), %%eax" : "=a"(value) : "D"(base), "S"(offset) : "memory");
+            }
+            else if constexpr (sizeof(T) == 2)
+            {
+                asm volatile("movzwl (%%rdi,%%rsi,1), %%eax" : "=a"(value) : "D"(base), "S"(offset) : "memory");
+            }
+            else
+            {
+                asm volatile("movl (%%rdi,%%rsi,1), %%eax" : "=a"(value) : "D"(base), "S"(offset) : "memory");
+            }
+            return static_cast<T>(value);
+#else
+            return *reinterpret_cast<const T*>(base + addr);
+#endif
+        }
+
+    private:
+#ifdef FASTMEM_SUPPORTED
+        static void handle_fault(int signal, siginfo_t* info, void* context);
+#endif
+
+        std::uint8_t* m_base;
+        std::uint8_t* m_storage;
+        std::size_t m_storage_size;
+        int m_fd;
+        FaultHandler m_fault_handler;
+        void* m_context;
+};
+
+#endif
@@ -0,0 +1,17 @@
+#include "interrupts.hpp"
+
+void Interrupts::register_io(Io& io)
+{
+    auto store = [](void* context, std::uint32_t offset, std::uint16_t value, std::uint16_t mask) {
+        auto* interrupts = static_cast<Interrupts*>(context);
+        Io::store(interrupts->m_mmio, offset, value, mask);
+        interrupts->update();
+    };
+    io.on_write(IE, IE + 2, store, this);
+    io.on_write(IME, IME + 2, store, this);
+    io.on_write(IF, IF + 2, [](void* context, std::uint32_t offset, std::uint16_t value, std::uint16_t mask) {
+        auto* interrupts = static_cast<Interrupts*>(context);
+        interrupts->reg(offset) &= ~(value & mask);
+        interrupts->update();
+    }, this);
+}
@@ -0,0 +1,59 @@
+#ifndef INTERRUPTS_HPP
+#define INTERRUPTS_HPP
+
+#include <cstdint>
+
+#include "io.hpp"
+
+// IE, IF and IME. The line into the cpu is worked out again whenever one of them or the cpu's
+// irq disable bit changes, so the cpu only has to test a single flag before each instruction.
+class Interrupts
+{
+    public:
+        enum Source : std::uint16_t
+        {
+            VBLANK = 1 << 0, HBLANK = 1 << 1, VCOUNT = 1 << 2, TIMER0 = 1 << 3, DMA0 = 1 << 8
+        };
+
+        explicit Interrupts(std::uint8_t* mmio) : m_mmio(mmio) {}
+
+        //! IE and IME writes, writing a one to a bit of IF acknowledges that interrupt
+        void register_io(Io& io);
+
+        void request(std::uint16_t sources) noexcept
+        {
+            reg(IF) |= sources;
+            update();
+        }
+
+        //! CPSR.I, set while the cpu has interrupts disabled
+        void set_cpu_disabled(bool disabled) noexcept
+        {
+            m_cpu_disabled = disabled;
+            update();
+        }
+
+        //! an enabled interrupt is requested, enough to leave halt even with IME clear
+        bool requested() const noexcept { return m_requested; }
+        //! an enabled interrupt is requested and both IME and the cpu let it through
+        bool line() const noexcept { return m_line; }
+
+    private:
+        static constexpr std::uint32_t IE = 0x200;
+        static constexpr std::uint32_t IF = 0x202;
+        static constexpr std::uint32_t IME = 0x208;
+
+        std::uint16_t& reg(std::uint32_t offset) const noexcept { return *reinterpret_cast<std::uint16_t*>(m_mmio + offset); }
+        void update() noexcept
+        {
+            m_requested = (reg(IE) & reg(IF)) != 0;
+            m_line = m_requested && (reg(IME) & 1) && !m_cpu_disabled;
+        }
+
+        std::uint8_t* m_mmio;
+        bool m_cpu_disabled = false;
+        bool m_requested = false;
+        bool m_line = false;
+};
+
+#endif
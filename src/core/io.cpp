@@ -0,0 +1,30 @@
+#include "io.hpp"
+
+Io::Io(std::uint8_t* regs)
+{
+    auto read = [](void* context, std::uint32_t offset) -> std::uint16_t {
+        return *reinterpret_cast<std::uint16_t*>(static_cast<std::uint8_t*>(context) + offset);
+    };
+    auto write = [](void* context, std::uint32_t offset, std::uint16_t value, std::uint16_t mask) {
+        store(static_cast<std::uint8_t*>(context), offset, value, mask);
+    };
+    m_entries.fill({read, regs, write, regs});
+}
+
+void Io::on_read(std::uint32_t start, std::uint32_t end, ReadHandler handler, void* context)
+{
+    for (std::uint32_t offset = start; offset < end; offset += 2)
+    {
+        m_entries[offset >> 1].read = handler;
+        m_entries[offset >> 1].read_context = context;
+    }
+}
+
+void Io::on_write(std::uint32_t start, std::uint32_t end, WriteHandler handler, void* context)
+{
+    for (std::uint32_t offset = start; offset < end; offset += 2)
+    {
+        m_entries[offset >> 1].write = handler;
+        m_entries[offset >> 1].write_context = context;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef IO_HPP
+#define IO_HPP
+
+#include <array>
+#include <cstdint>
+
+// Handlers for the io registers, one read and one write handler per halfword. Components register
+// the registers with side effects they own, the rest read and write the backing array as they are.
+// Byte and word accesses are split into halfword accesses.
+class Io
+{
+    public:
+        using ReadHandler = std::uint16_t (*)(void* context, std::uint32_t offset);
+        //! mask holds the bits being written, a byte write only covers one half of it
+        using WriteHandler = void (*)(void* context, std::uint32_t offset, std::uint16_t value, std::uint16_t mask);
+
+        static constexpr std::uint32_t SIZE = 0x400;
+
+        explicit Io(std::uint8_t* regs);
+
+        //! handlers for the halfwords in [start, end)
+        void on_read(std::uint32_t start, std::uint32_t end, ReadHandler handler, void* context);
+        void on_write(std::uint32_t start, std::uint32_t end, WriteHandler handler, void* context);
+
+        //! what registers without a write handler do, sets the bits in mask to value
+        static void store(std::uint8_t* regs, std::uint32_t offset, std::uint16_t value, std::uint16_t mask) noexcept
+        {
+            std::uint16_t& reg = *reinterpret_cast<std::uint16_t*>(regs + offset);
+            reg = (reg & ~mask) | (value & mask);
+        }
+
+        template <typename T>
+        T read(std::uint32_t offset)
+        {
+            if constexpr (sizeof(T) == 4)
+            {
+                return read_halfword(offset) | (static_cast<std::uint32_t>(read_halfword(offset + 2)) << 16);
+            }
+            return static_cast<T>(read_halfword(offset & ~1) >> ((offset & 1) * 8));
+        }
+
+        template <typename T>
+        void write(std::uint32_t offset, T value)
+        {
+            if constexpr (sizeof(T) == 4)
+            {
+                write_halfword(offset, value, 0xFFFF);
+                write_halfword(offset + 2, value >> 16, 0xFFFF);
+            }
+            else if constexpr (sizeof(T) == 2)
+            {
+                write_halfword(offset, value, 0xFFFF);
+            }
+            else
+            {
+                int shift = (offset & 1) * 8;
+                write_halfword(offset & ~1, value << shift, 0xFF << shift);
+            }
+        }
+
+    private:
+        struct Entry
+        {
+            ReadHandler read;
+            void* read_context;
+            WriteHandler write;
+            void* write_context;
+        };
+
+        std::uint16_t read_halfword(std::uint32_t offset)
+        {
+            const Entry& entry = m_entries[offset >> 1];
+            return entry.read(entry.read_context, offset);
+        }
+
+        void write_halfword(std::uint32_t offset, std::uint16_t value, std::uint16_t mask)
+        {
+            const Entry& entry = m_entries[offset >> 1];
+            entry.write(entry.write_context, offset, value, mask);
+        }
+
+        std::array<Entry, SIZE / 2> m_entries;
+};
+
+#endif
@@ -0,0 +1,495 @@
+#include "jit.hpp"
+
+#include <cstddef>
+#include <cstring>
+
+#include "cpu.hpp"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_SUPPORTED 1
+#include <sys/mman.h>
+#endif
+
+static const std::size_t CODE_BUFFER_SIZE = 16 * 1024 * 1024;
+// what the interpreter's alu handlers return, fetch wait states are added by the cpu for both
+static const std::uint8_t ALU_CYCLES = 1;
+
+// host registers, the compiled block keeps the cpu in rbx, guest registers in r12,
+// guest flags in r14, accumulated cycles in r13 and the shifter carry in r15b
+enum HostReg : std::uint8_t
+{
+    RAX = 0, RCX = 1
+};
+
+enum SetCC : std::uint8_t
+{
+    SETO = 0x90, SETC = 0x92, SETNC = 0x93, SETZ = 0x94, SETS = 0x98
+};
+
+static const std::uint8_t FLAG_N = offsetof(CPU::Flags, n);
+static const std::uint8_t FLAG_Z = offsetof(CPU::Flags, z);
+static const std::uint8_t FLAG_C = offsetof(CPU::Flags, c);
+static const std::uint8_t FLAG_V = offsetof(CPU::Flags, v);
+
+Jit::Jit() : m_buffer(nullptr), m_used(0), m_exhausted(false)
+{
+#ifdef JIT_SUPPORTED
+    void* buffer = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer != MAP_FAILED)
+    {
+        m_buffer = static_cast<std::uint8_t*>(buffer);
+    }
+#endif
+}
+
+Jit::~Jit()
+{
+#ifdef JIT_SUPPORTED
+    if (m_buffer != nullptr)
+    {
+        munmap(m_buffer, CODE_BUFFER_SIZE);
+    }
+#endif
+}
+
+int Jit::call_arm_handler(CPU* cpu, const DecodedInstr* decoded)
+{
+    int cycles = 1;
+    cpu->m_next_data_addr = ~0u;
+    if (cpu->condition(decoded->instr))
+    {
+        cycles = (cpu->*decoded->handler)(decoded->instr);
+        cpu->materialize_flags();
+    }
+    return cycles;
+}
+
+int Jit::call_thumb_handler(CPU* cpu, const DecodedInstr* decoded)
+{
+    cpu->m_next_data_addr = ~0u;
+    int cycles = (cpu->*decoded->handler)(decoded->instr);
+    cpu->materialize_flags();
+    return cycles;
+}
+
+CompiledBlock Jit::compile(const Block& block, bool thumb)
+{
+    if (m_buffer == nullptr) return nullptr;
+
+    m_code.clear();
+    m_exit_patches.clear();
+    emit_prologue();
+
+    std::size_t native_instrs = 0;
+    std::uint32_t pc = block.start;
+    std::uint32_t instr_size = 4 >> thumb;
+    for (std::size_t i = 0; i < block.instrs.size(); i++)
+    {
+        const auto& decoded = block.instrs[i];
+        emit_store_pc(pc + (instr_size * 2));
+
+        // THUMB data processing goes through the same emitter as its ARM encoding
+        std::uint32_t arm_instr = decoded.instr;
+        bool data_processing = thumb ? CPU::translate_thumb_alu(decoded.instr, arm_instr)
+            : (CPU::m_arm_formats[CPU::arm_lut_index(decoded.instr)] == CPU::InstrFormat::ALU);
+        if (data_processing && emit_alu(arm_instr))
+        {
+            native_instrs++;
+        }
+        else
+        {
+            emit_handler_call(decoded, thumb);
+            if ((i + 1 < block.instrs.size()) && may_store(decoded.instr, thumb))
+            {
+                emit_invalidation_check(i + 1);
+            }
+        }
+        pc += instr_size;
+    }
+    emit_epilogue();
+
+    // a block of interpreter calls only adds the prologue and epilogue on top of the interpreter
+    if (native_instrs == 0) return nullptr;
+    if ((m_used + m_code.size()) > CODE_BUFFER_SIZE)
+    {
+        m_exhausted = true;
+        return nullptr;
+    }
+
+    std::uint8_t* code = m_buffer + m_used;
+    std::memcpy(code, m_code.data(), m_code.size());
+    m_used += (m_code.size() + 15) & ~15;
+    return reinterpret_cast<CompiledBlock>(code);
+}
+
+bool Jit::may_store(std::uint32_t instr, bool thumb)
+{
+    if (thumb)
+    {
+        switch (CPU::m_thumb_lut[instr >> 6])
+        {
+        case CPU::InstrFormat::THUMB_7:
+        case CPU::InstrFormat::THUMB_9:
+        case CPU::InstrFormat::THUMB_10:
+        case CPU::InstrFormat::THUMB_11:
+        case CPU::InstrFormat::THUMB_14:
+        case CPU::InstrFormat::THUMB_15: return !((instr >> 11) & 1);
+        case CPU::InstrFormat::THUMB_8: return ((instr >> 10) & 0x3) == 0;
+        case CPU::InstrFormat::THUMB_17: return true;
+        default: return false;
+        }
+    }
+
+    switch (CPU::m_arm_formats[CPU::arm_lut_index(instr)])
+    {
+    case CPU::InstrFormat::SINGLE_TRANSFER:
+    case CPU::InstrFormat::HALFWORD_TRANSFER:
+    case CPU::InstrFormat::BLOCK_TRANSFER: return !((instr >> 20) & 1);
+    case CPU::InstrFormat::SWP:
+    case CPU::InstrFormat::SWI: return true;
+    default: return false;
+    }
+}
+
+bool Jit::leave_block(CPU* cpu, std::uint32_t executed)
+{
+    // the scheduler only moves once the block returns. a store that overwrote code, halted the cpu,
+    // raised the irq line or scheduled an earlier event (an immediate dma) has to take effect before
+    // the next instruction, so the interpreter picks up at the next pc
+    Memory& mem = cpu->m_mem;
+    bool leave = mem.has_invalidated_code() || mem.halted() || mem.irq_line()
+        || (mem.next_event() < cpu->m_block_next_event) || (mem.next_event() <= mem.cycles());
+    if (!leave) [[likely]] return false;
+    cpu->m_block_idx = executed;
+    return true;
+}
+
+bool Jit::emit_alu(std::uint32_t instr)
+{
+    std::uint8_t cond = (instr >> 28) & 0xF;
+    bool imm = (instr >> 25) & 1;
+    std::uint8_t opcode = (instr >> 21) & 0xF;
+    bool set_cc = (instr >> 20) & 1;
+    std::uint8_t rn = (instr >> 16) & 0xF;
+    std::uint8_t rd = (instr >> 12) & 0xF;
+    std::uint8_t shift_amount = (instr >> 7) & 0x1F;
+    std::uint8_t shift_type = (instr >> 5) & 0x3;
+    bool test_only = (opcode >= 0x8) && (opcode <= 0xB);
+
+    // carry-in ops, writes to pc (mode restore) and register specified shifts stay in the interpreter
+    if ((cond == 0xF) || ((opcode >= 0x5) && (opcode <= 0x7)) || (rd == 0xF)) return false;
+    if (!imm && ((instr >> 4) & 1)) return false;
+    if (!imm && (shift_type == 3) && (shift_amount == 0)) return false;
+
+    std::size_t skip_patch = 0;
+    if (cond != 0xE)
+    {
+        emit_condition(cond);
+        emit({0x0F, 0x84}); // jz rel32
+        skip_patch = m_code.size();
+        emit32(0);
+    }
+
+    if ((opcode != 0xD) && (opcode != 0xF))
+    {
+        emit_load_reg(RAX, rn);
+    }
+
+    ShifterCarry carry = ShifterCarry::UNCHANGED;
+    bool constant_carry = false;
+    if (imm)
+    {
+        std::uint8_t rotate = ((instr >> 8) & 0xF) * 2;
+        std::uint32_t value = instr & 0xFF;
+        value = (value >> rotate) | (value << ((32 - rotate) & 31));
+        emit({0xB9}); // mov ecx, imm32
+        emit32(value);
+        if (rotate)
+        {
+            carry = ShifterCarry::CONSTANT;
+            constant_carry = value >> 31;
+        }
+    }
+    else
+    {
+        emit_load_reg(RCX, instr & 0xF);
+        switch (shift_type)
+        {
+        case 0: // LSL
+            if (shift_amount)
+            {
+                emit({0xC1, 0xE1, shift_amount}); // shl ecx, imm8
+                carry = ShifterCarry::COMPUTED;
+            }
+            break;
+        case 1: // LSR
+            if (shift_amount)
+            {
+                emit({0xC1, 0xE9, shift_amount}); // shr ecx, imm8
+            }
+            else
+            {
+                emit({0x0F, 0xBA, 0xE1, 0x1F}); // bt ecx, 31
+            }
+            carry = ShifterCarry::COMPUTED;
+            break;
+        case 2: // ASR
+            if (shift_amount)
+            {
+                emit({0xC1, 0xF9, shift_amount}); // sar ecx, imm8
+            }
+            else
+            {
+                emit({0x0F, 0xBA, 0xE1, 0x1F}); // bt ecx, 31
+            }
+            carry = ShifterCarry::COMPUTED;
+            break;
+        case 3: // ROR
+            emit({0xC1, 0xC9, shift_amount}); // ror ecx, imm8
+            carry = ShifterCarry::COMPUTED;
+            break;
+        }
+
+        // the shifter carry is captured before the operation clobbers host flags
+        if (carry == ShifterCarry::COMPUTED)
+        {
+            emit({0x41, 0x0F, 0x92, 0xC7}); // setc r15b
+        }
+
+        // shift by 32 forms, bt above already produced their carry
+        if ((shift_type == 1) && !shift_amount)
+        {
+            emit({0x31, 0xC9}); // xor ecx, ecx
+        }
+        else if ((shift_type == 2) && !shift_amount)
+        {
+            emit({0xC1, 0xF9, 0x1F}); // sar ecx, 31
+        }
+    }
+
+    bool logical = true;
+    switch (opcode)
+    {
+    case 0x0: // AND
+    case 0x8: // TST
+        emit({0x21, 0xC8}); // and eax, ecx
+        break;
+    case 0x1: // EOR
+    case 0x9: // TEQ
+        emit({0x31, 0xC8}); // xor eax, ecx
+        break;
+    case 0x2: // SUB
+    case 0xA: // CMP
+        emit({0x29, 0xC8}); // sub eax, ecx
+        logical = false;
+        break;
+    case 0x3: // RSB
+        emit({0x29, 0xC1}); // sub ecx, eax
+        emit({0x89, 0xC8}); // mov eax, ecx
+        logical = false;
+        break;
+    case 0x4: // ADD
+    case 0xB: // CMN
+        emit({0x01, 0xC8}); // add eax, ecx
+        logical = false;
+        break;
+    case 0xC: // ORR
+        emit({0x09, 0xC8}); // or eax, ecx
+        break;
+    case 0xD: // MOV
+        emit({0x89, 0xC8}); // mov eax, ecx
+        break;
+    case 0xE: // BIC
+        emit({0xF7, 0xD1}); // not ecx
+        emit({0x21, 0xC8}); // and eax, ecx
+        break;
+    case 0xF: // MVN
+        emit({0xF7, 0xD1}); // not ecx
+        emit({0x89, 0xC8}); // mov eax, ecx
+        break;
+    }
+
+    if (set_cc)
+    {
+        if (logical)
+        {
+            emit({0x85, 0xC0}); // test eax, eax
+            emit_setcc_flag(SETS, FLAG_N);
+            emit_setcc_flag(SETZ, FLAG_Z);
+            if (carry == ShifterCarry::COMPUTED)
+            {
+                emit({0x45, 0x88, 0x7E, FLAG_C}); // mov [r14 + c], r15b
+            }
+            else if (carry == ShifterCarry::CONSTANT)
+            {
+                emit({0x41, 0xC6, 0x46, FLAG_C, constant_carry}); // mov byte [r14 + c], imm8
+            }
+        }
+        else
+        {
+            emit_setcc_flag(SETS, FLAG_N);
+            emit_setcc_flag(SETZ, FLAG_Z);
+            emit_setcc_flag(((opcode == 0x4) || (opcode == 0xB)) ? SETC : SETNC, FLAG_C);
+            emit_setcc_flag(SETO, FLAG_V);
+        }
+    }
+
+    if (!test_only)
+    {
+        emit_store_reg(rd);
+    }
+
+    if (cond != 0xE)
+    {
+        std::uint32_t rel = m_code.size() - (skip_patch + 4);
+        std::memcpy(m_code.data() + skip_patch, &rel, 4);
+    }
+
+    // charged like the interpreter's handlers, failed conditions included
+    emit({0x41, 0x83, 0xC5, ALU_CYCLES}); // add r13d, imm8
+    return true;
+}
+
+void Jit::emit_condition(std::uint8_t cond)
+{
+    auto load_flag = [this](std::uint8_t host_reg, std::uint8_t flag) {
+        emit({0x41, 0x0F, 0xB6, static_cast<std::uint8_t>(0x46 | (host_reg << 3)), flag}); // movzx reg, byte [r14 + flag]
+    };
+    auto invert = [this]() {
+        emit({0x83, 0xF0, 0x01}); // xor eax, 1
+    };
+
+    switch (cond)
+    {
+    case 0x0: load_flag(RAX, FLAG_Z); break;
+    case 0x1: load_flag(RAX, FLAG_Z); invert(); break;
+    case 0x2: load_flag(RAX, FLAG_C); break;
+    case 0x3: load_flag(RAX, FLAG_C); invert(); break;
+    case 0x4: load_flag(RAX, FLAG_N); break;
+    case 0x5: load_flag(RAX, FLAG_N); invert(); break;
+    case 0x6: load_flag(RAX, FLAG_V); break;
+    case 0x7: load_flag(RAX, FLAG_V); invert(); break;
+    case 0x8:
+    case 0x9:
+        load_flag(RAX, FLAG_Z);
+        invert();
+        load_flag(RCX, FLAG_C);
+        emit({0x21, 0xC8}); // and eax, ecx
+        if (cond == 0x9) invert();
+        break;
+    case 0xA:
+    case 0xB:
+        load_flag(RAX, FLAG_N);
+        load_flag(RCX, FLAG_V);
+        emit({0x31, 0xC8}); // xor eax, ecx
+        if (cond == 0xA) invert();
+        break;
+    case 0xC:
+    case 0xD:
+        load_flag(RAX, FLAG_N);
+        load_flag(RCX, FLAG_V);
+        emit({0x31, 0xC8}); // xor eax, ecx
+        load_flag(RCX, FLAG_Z);
+        emit({0x09, 0xC8}); // or eax, ecx
+        if (cond == 0xC) invert();
+        break;
+    }
+    emit({0x85, 0xC0}); // test eax, eax
+}
+
+void Jit::emit_handler_call(const DecodedInstr& decoded, bool thumb)
+{
+    auto handler = thumb ? &Jit::call_thumb_handler : &Jit::call_arm_handler;
+    emit({0x48, 0x89, 0xDF}); // mov rdi, rbx
+    emit({0x48, 0xBE}); // mov rsi, imm64
+    emit64(reinterpret_cast<std::uint64_t>(&decoded));
+    emit({0x48, 0xB8}); // mov rax, imm64
+    emit64(reinterpret_cast<std::uint64_t>(handler));
+    emit({0xFF, 0xD0}); // call rax
+    emit({0x41, 0x01, 0xC5}); // add r13d, eax
+}
+
+void Jit::emit_invalidation_check(std::uint32_t executed)
+{
+    emit({0x48, 0x89, 0xDF}); // mov rdi, rbx
+    emit({0xBE}); // mov esi, imm32
+    emit32(executed);
+    emit({0x48, 0xB8}); // mov rax, imm64
+    emit64(reinterpret_cast<std::uint64_t>(&Jit::leave_block));
+    emit({0xFF, 0xD0}); // call rax
+    emit({0x84, 0xC0}); // test al, al
+    emit({0x0F, 0x85}); // jnz rel32
+    m_exit_patches.push_back(m_code.size());
+    emit32(0);
+}
+
+void Jit::emit_prologue()
+{
+    emit({0x53}); // push rbx
+    emit({0x41, 0x54}); // push r12
+    emit({0x41, 0x55}); // push r13
+    emit({0x41, 0x56}); // push r14
+    emit({0x41, 0x57}); // push r15
+    emit({0x48, 0x89, 0xFB}); // mov rbx, rdi
+    emit({0x49, 0x89, 0xF4}); // mov r12, rsi
+    emit({0x49, 0x89, 0xD6}); // mov r14, rdx
+    emit({0x45, 0x31, 0xED}); // xor r13d, r13d
+}
+
+void Jit::emit_epilogue()
+{
+    for (auto patch : m_exit_patches)
+    {
+        std::uint32_t rel = m_code.size() - (patch + 4);
+        std::memcpy(m_code.data() + patch, &rel, 4);
+    }
+    emit({0x44, 0x89, 0xE8}); // mov eax, r13d
+    emit({0x41, 0x5F}); // pop r15
+    emit({0x41, 0x5E}); // pop r14
+    emit({0x41, 0x5D}); // pop r13
+    emit({0x41, 0x5C}); // pop r12
+    emit({0x5B}); // pop rbx
+    emit({0xC3}); // ret
+}
+
+void Jit::emit_load_reg(std::uint8_t host_reg, std::uint8_t reg)
+{
+    emit({0x41, 0x8B, static_cast<std::uint8_t>(0x44 | (host_reg << 3)), 0x24, static_cast<std::uint8_t>(reg * 4)}); // mov reg, [r12 + disp8]
+}
+
+void Jit::emit_store_reg(std::uint8_t reg)
+{
+    emit({0x41, 0x89, 0x44, 0x24, static_cast<std::uint8_t>(reg * 4)}); // mov [r12 + disp8], eax
+}
+
+void Jit::emit_store_pc(std::uint32_t value)
+{
+    emit({0x41, 0xC7, 0x44, 0x24, 15 * 4}); // mov dword [r12 + disp8], imm32
+    emit32(value);
+}
+
+void Jit::emit_setcc_flag(std::uint8_t setcc, std::uint8_t flag)
+{
+    emit({0x41, 0x0F, setcc, 0x46, flag}); // setcc byte [r14 + disp8]
+}
+
+void Jit::emit(std::initializer_list<std::uint8_t> bytes)
+{
+    m_code.insert(m_code.end(), bytes);
+}
+
+void Jit::emit32(std::uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        m_code.push_back((value >> (i * 8)) & 0xFF);
+    }
+}
+
+void Jit::emit64(std::uint64_t value)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        m_code.push_back((value >> (i * 8)) & 0xFF);
+    }
+}
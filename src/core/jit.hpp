@@ -0,0 +1,63 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#include "block_cache.hpp"
+
+// x86-64 recompiler for decoded blocks. Data processing ops are emitted as native code,
+// everything else calls back into the interpreter handler of the decoded instruction.
+class Jit
+{
+    public:
+        Jit();
+        ~Jit();
+
+        Jit(const Jit&) = delete;
+        Jit& operator=(const Jit&) = delete;
+
+        bool available() const noexcept { return m_buffer != nullptr; }
+
+        //! returns nullptr for blocks without native instructions or when the code buffer is exhausted
+        CompiledBlock compile(const Block& block, bool thumb);
+        bool exhausted() const noexcept { return m_exhausted; }
+        void reset() noexcept { m_used = 0; m_exhausted = false; }
+
+    private:
+        enum class ShifterCarry
+        {
+            UNCHANGED = 0, CONSTANT, COMPUTED
+        };
+
+        static int call_arm_handler(CPU* cpu, const DecodedInstr* decoded);
+        static int call_thumb_handler(CPU* cpu, const DecodedInstr* decoded);
+        static bool leave_block(CPU* cpu, std::uint32_t executed);
+        static bool may_store(std::uint32_t instr, bool thumb);
+
+        bool emit_alu(std::uint32_t instr);
+        void emit_condition(std::uint8_t cond);
+        void emit_handler_call(const DecodedInstr& decoded, bool thumb);
+        //! leaves the block after a store that overwrote code, executed is the number of instructions run so far
+        void emit_invalidation_check(std::uint32_t executed);
+        void emit_prologue();
+        void emit_epilogue();
+
+        void emit_load_reg(std::uint8_t host_reg, std::uint8_t reg);
+        void emit_store_reg(std::uint8_t reg);
+        void emit_store_pc(std::uint32_t value);
+        void emit_setcc_flag(std::uint8_t setcc, std::uint8_t flag);
+
+        void emit(std::initializer_list<std::uint8_t> bytes);
+        void emit32(std::uint32_t value);
+        void emit64(std::uint64_t value);
+
+        std::uint8_t* m_buffer;
+        std::size_t m_used;
+        bool m_exhausted;
+        std::vector<std::uint8_t> m_code;
+        std::vector<std::size_t> m_exit_patches;
+};
+
+#endif
@@ -1,9 +1,19 @@
 #include "memory.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <utility>
 
-// TODO: https://gbadev.net/gbadoc/registers.html#dma-control-registers
+#if defined(__unix__) || defined(__APPLE__)
+#define ROM_MMAP_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 void Memory::load_bios() 
 {
@@ -23,6 +33,29 @@ void Memory::load_bios()
 
 void Memory::load_rom(const std::string& rom_filepath) 
 {
+    unload_rom();
+#ifdef ROM_MMAP_SUPPORTED
+    int fd = open(rom_filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) 
+    {
+        throw std::runtime_error("failed to open " + rom_filepath);
+    }
+
+    struct stat st;
+    std::size_t size = 0;
+    if (fstat(fd, &st) == 0)
+    {
+        size = std::min<std::size_t>(st.st_size, ROM_SIZE);
+    }
+    void* rom = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (rom == MAP_FAILED)
+    {
+        close(fd);
+        throw std::runtime_error("failed to map " + rom_filepath);
+    }
+    m_rom_fd = fd;
+    m_rom = {static_cast<std::uint8_t*>(rom), size};
+#else
     FILE *fp = fopen(rom_filepath.c_str(), "rb");
     if (fp == NULL) 
     {
@@ -30,30 +63,374 @@ void Memory::load_rom(const std::string& rom_filepath)
     }
 
     fseek(fp, 0, SEEK_END);
-    size_t size = ftell(fp);
+    size_t size = std::min<std::size_t>(ftell(fp), ROM_SIZE);
     fseek(fp, 0, SEEK_SET);
-    fread(m_rom.data(), sizeof(std::uint8_t), size, fp);
+    m_rom_buffer.resize(size);
+    fread(m_rom_buffer.data(), sizeof(std::uint8_t), size, fp);
+    m_rom = m_rom_buffer;
 
     fclose(fp);
+#endif
+    m_backup.load(m_rom, std::filesystem::path(rom_filepath).replace_extension(".sav").string());
+    m_eeprom_start = 0x0E000000;
+    if (m_backup.type() == Backup::Type::EEPROM)
+    {
+        m_eeprom_start = (m_rom.size() > 0x1000000) ? 0x0DFFFF00 : 0x0D000000;
+    }
+    map_pages();
+    if (m_fastmem && !map_fastmem_rom(*m_fastmem))
+    {
+        set_fastmem_enabled(false);
+    }
+}
+
+void Memory::unload_rom()
+{
+#ifdef ROM_MMAP_SUPPORTED
+    if (m_rom_fd >= 0)
+    {
+        munmap(m_rom.data(), m_rom.size());
+        close(m_rom_fd);
+        m_rom_fd = -1;
+    }
+#endif
+    m_rom_buffer = {};
+    m_rom = {};
+}
+
+std::string Memory::game_code() const
+{
+    if (m_rom.size() < 0xB0) return {};
+    return std::string(reinterpret_cast<const char*>(m_rom.data() + 0xAC), 4);
+}
+
+bool Memory::set_fastmem_enabled(bool enabled)
+{
+    if (enabled == fastmem_enabled()) return true;
+
+    if (enabled)
+    {
+        auto fastmem = std::make_unique<FastMem>(STORAGE_SIZE, &Memory::fastmem_fault, this);
+        if (!fastmem->available() || !map_fastmem(*fastmem)) return false;
+
+        std::memcpy(fastmem->storage(), m_storage.data(), STORAGE_SIZE);
+        m_fastmem = std::move(fastmem);
+        m_fastmem_base = m_fastmem->base();
+        attach_storage(m_fastmem->storage());
+        m_storage = {};
+    }
+    else
+    {
+        m_storage.assign(m_fastmem->storage(), m_fastmem->storage() + STORAGE_SIZE);
+        attach_storage(m_storage.data());
+        m_fastmem_base = nullptr;
+        m_fastmem.reset();
+    }
+    return true;
+}
+
+void Memory::attach_storage(std::uint8_t* storage)
+{
+    m_bios = {storage + BIOS_OFFSET, 0x4000};
+    m_ewram = {storage + EWRAM_OFFSET, 0x40000};
+    m_iwram = {storage + IWRAM_OFFSET, 0x8000};
+    m_ppu.m_vram = {storage + VRAM_OFFSET, 0x18000};
+    map_pages();
+}
+
+bool Memory::map_fastmem(FastMem& fastmem)
+{
+    // writes keep going through the page table, they have to check for translated code and
+    // byte writes to video memory. palette, oam and mmio mirror below the host page size and fault
+    bool mapped = fastmem.map(0x00000000, 0x00004000, BIOS_OFFSET, 0x4000)
+        && fastmem.map(0x02000000, 0x03000000, EWRAM_OFFSET, 0x40000)
+        && fastmem.map(0x03000000, 0x04000000, IWRAM_OFFSET, 0x8000)
+        && map_fastmem_rom(fastmem);
+    for (std::uint32_t mirror = 0x06000000; mapped && (mirror < 0x07000000); mirror += 0x20000)
+    {
+        mapped = fastmem.map(mirror, mirror + 0x18000, VRAM_OFFSET, 0x18000)
+            && fastmem.map(mirror + 0x18000, mirror + 0x20000, VRAM_OFFSET + 0x10000, 0x8000);
+    }
+    return mapped;
+}
+
+bool Memory::map_fastmem_rom(FastMem& fastmem)
+{
+#ifdef ROM_MMAP_SUPPORTED
+    // only whole host pages, the tail of the last one faults so reads past the end see open bus
+    std::size_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+    std::size_t length = m_rom.size() & ~page_mask;
+    for (std::uint32_t mirror = 0x08000000; (m_rom_fd >= 0) && (length != 0) && (mirror < 0x0E000000); mirror += ROM_SIZE)
+    {
+        // the eeprom window has to fault
+        std::size_t mapped = std::min<std::size_t>(length, (m_eeprom_start - mirror) & ~page_mask);
+        if ((mapped != 0) && !fastmem.map_file(mirror, m_rom_fd, mapped)) return false;
+    }
+#endif
+    return true;
+}
+
+std::uint32_t Memory::fastmem_fault(void* context, std::uint32_t addr, int size)
+{
+    auto* memory = static_cast<Memory*>(context);
+    switch (size)
+    {
+    case 1: return memory->read_paged<std::uint8_t>(addr);
+    case 2: return memory->read_paged<std::uint16_t>(addr);
+    default: return memory->read_paged<std::uint32_t>(addr);
+    }
+}
+
+void Memory::map_pages()
+{
+    m_read_pages.assign(PAGE_COUNT, {});
+    m_write_pages.assign(PAGE_COUNT, {});
+
+    map_region(0x00000000, 0x00004000, m_bios.data(), 0x4000, false, false);
+    map_region(0x02000000, 0x03000000, m_ewram.data(), 0x40000, true, true, 0);
+    map_region(0x03000000, 0x04000000, m_iwram.data(), 0x8000, true, true, EWRAM_CODE_PAGES);
+    map_region(0x05000000, 0x06000000, m_ppu.m_pallete_ram.data(), 0x400, true, false, -1, PPU::Region::PALETTE);
+    // 96 KiB of vram mirrored every 128 KiB, the last 32 KiB of each mirror repeat the obj tiles
+    for (std::uint32_t mirror = 0x06000000; mirror < 0x07000000; mirror += 0x20000)
+    {
+        map_region(mirror, mirror + 0x18000, m_ppu.m_vram.data(), 0x18000, true, false, -1, PPU::Region::VRAM);
+        map_region(mirror + 0x18000, mirror + 0x20000, m_ppu.m_vram.data() + 0x10000, 0x8000, true, false, -1, PPU::Region::VRAM);
+    }
+    map_region(0x07000000, 0x08000000, m_ppu.m_oam.data(), 0x400, true, false, -1, PPU::Region::OAM);
+    // pages the rom fills completely map the file, a partial last page maps a copy padded with
+    // the open bus pattern and anything after that reads through the slow path
+    std::uint32_t rom_pages_end = m_rom.size() & ~(PAGE_SIZE - 1);
+    std::uint32_t rom_tail = m_rom.size() - rom_pages_end;
+    for (std::uint32_t offset = 0; offset < PAGE_SIZE; offset += 2)
+    {
+        std::uint16_t open_bus = ((rom_pages_end + offset) >> 1) & 0xFFFF;
+        std::memcpy(m_rom_tail.data() + offset, &open_bus, 2);
+    }
+    std::copy_n(m_rom.data() + rom_pages_end, rom_tail, m_rom_tail.data());
+    for (std::uint32_t mirror = 0x08000000; mirror < 0x0E000000; mirror += ROM_SIZE)
+    {
+        if (rom_pages_end != 0) map_region(mirror, mirror + rom_pages_end, m_rom.data(), rom_pages_end, false, false);
+        if (rom_tail != 0) map_region(mirror + rom_pages_end, mirror + rom_pages_end + PAGE_SIZE, m_rom_tail.data(), PAGE_SIZE, false, false);
+    }
+    // eeprom reads go through the slow path, for roms over 16 MiB that includes the rest of its page
+    for (std::uint32_t addr = m_eeprom_start & ~(PAGE_SIZE - 1); addr < 0x0E000000; addr += PAGE_SIZE)
+    {
+        m_read_pages[addr >> PAGE_SHIFT] = {};
+    }
+}
+
+void Memory::map_region(std::uint32_t start, std::uint32_t end, std::uint8_t* host, std::uint32_t size, bool writable, bool byte_writes, int code_page,
+    PPU::Region video)
+{
+    for (std::uint32_t addr = start; addr < end; addr += PAGE_SIZE)
+    {
+        Page page;
+        if (size >= PAGE_SIZE)
+        {
+            std::uint32_t offset = (addr - start) % size;
+            page.base = host + offset;
+            page.mask = PAGE_SIZE - 1;
+            if (code_page >= 0) page.code_page = code_page + (offset >> CODE_PAGE_SHIFT);
+        }
+        else
+        {
+            page.base = host;
+            page.mask = size - 1;
+        }
+        page.byte_writes = byte_writes;
+        page.video = video;
+
+        m_read_pages[addr >> PAGE_SHIFT] = page;
+        if (writable) m_write_pages[addr >> PAGE_SHIFT] = page;
+    }
+}
+
+void Memory::register_io()
+{
+    m_io.on_write(WAITCNT, WAITCNT + 2, [](void* context, std::uint32_t offset, std::uint16_t value, std::uint16_t mask) {
+        auto* memory = static_cast<Memory*>(context);
+        Io::store(memory->m_mmio.data(), offset, value, mask);
+        memory->update_wait_states();
+    }, this);
+    m_io.on_write(HALTCNT & ~1, HALTCNT + 1, [](void* context, std::uint32_t offset, std::uint16_t value, std::uint16_t mask) {
+        auto* memory = static_cast<Memory*>(context);
+        Io::store(memory->m_mmio.data(), offset, value, mask);
+        // stop mode waits on keypad and serial interrupts, neither is emulated so it halts as well
+        if (mask & 0xFF00)
+        {
+            memory->m_halted = true;
+        }
+    }, this);
+    // the keys are the only thing that changes KEYINPUT
+    m_io.on_write(KEYINPUT, KEYINPUT + 2, [](void*, std::uint32_t, std::uint16_t, std::uint16_t) {}, nullptr);
+}
+
+int Memory::track_code(std::uint32_t addr)
+{
+    int page;
+    switch ((addr >> 24) & 0xFF)
+    {
+    case 0x02:
+        page = ((addr - 0x02000000) & 0x3FFFF) >> CODE_PAGE_SHIFT;
+        break;
+    case 0x03:
+        page = EWRAM_CODE_PAGES + (((addr - 0x03000000) & 0x7FFF) >> CODE_PAGE_SHIFT);
+        break;
+    default: return -1;
+    }
+    m_code_pages[page] = true;
+    return page;
+}
+
+void Memory::update_wait_states()
+{
+    std::uint16_t waitcnt = *reinterpret_cast<std::uint16_t*>(m_mmio.data() + WAITCNT);
+    static constexpr std::array<std::uint8_t, 4> N_WAITS = {4, 3, 2, 8};
+    static constexpr std::array<std::array<std::uint8_t, 2>, 3> S_WAITS = {{{2, 1}, {4, 1}, {8, 1}}};
+
+    // bios, iwram, io and oam are 32 bit wide without waits, palette and vram are 16 bit wide
+    m_cycles_n16.fill(1);
+    m_cycles_n32.fill(1);
+    m_cycles_n16[0x2] = 3;
+    m_cycles_n32[0x2] = 6;
+    m_cycles_n32[0x5] = 2;
+    m_cycles_n32[0x6] = 2;
+
+    // the three game pak wait state regions are 16 bit wide and mirrored over two address nibbles each
+    for (int ws = 0; ws < 3; ws++)
+    {
+        int n = 1 + N_WAITS[(waitcnt >> (2 + (ws * 3))) & 3];
+        int s = 1 + S_WAITS[ws][(waitcnt >> (4 + (ws * 3))) & 1];
+        for (int region = 0x8 + (ws * 2); region < 0xA + (ws * 2); region++)
+        {
+            m_cycles_n16[region] = n;
+            m_cycles_s16[region] = s;
+            m_cycles_n32[region] = n + s;
+            m_cycles_s32[region] = 2 * s;
+        }
+    }
+
+    // sram has an 8 bit bus and no sequential accesses
+    int sram = 1 + N_WAITS[waitcnt & 3];
+    m_cycles_n16[0xE] = m_cycles_n16[0xF] = sram;
+    m_cycles_n32[0xE] = m_cycles_n32[0xF] = sram;
+
+    for (int region = 0; region < 0x10; region++)
+    {
+        if ((region < 0x8) || (region >= 0xE))
+        {
+            m_cycles_s16[region] = m_cycles_n16[region];
+            m_cycles_s32[region] = m_cycles_n32[region];
+        }
+    }
+
+    m_prefetch_enabled = (waitcnt >> 14) & 1;
+    m_prefetch_capacity = 8 * m_cycles_s16[0x8];
+    m_prefetch_cycles = 0;
+}
+
+std::uint8_t* Memory::host_range(std::uint32_t addr, std::uint32_t length, bool write)
+{
+    const auto& pages = write ? m_write_pages : m_read_pages;
+    std::uint8_t* start = nullptr;
+    for (std::uint32_t done = 0; done < length;)
+    {
+        std::uint32_t at = addr + done;
+        if (at >= PAGED_ADDRESS_END) return nullptr;
+
+        const Page& page = pages[at >> PAGE_SHIFT];
+        if (page.base == nullptr) return nullptr;
+
+        // mirrors inside a page wrap back to the base and break contiguity
+        std::uint8_t* host = page.base + (at & page.mask);
+        if (start == nullptr)
+        {
+            start = host;
+        }
+        else if (host != start + done)
+        {
+            return nullptr;
+        }
+        done += std::min(length - done, page.mask + 1 - (at & page.mask));
+    }
+    return start;
 }
 
-bool Memory::pending_interrupts()
+void Memory::range_written(std::uint32_t addr, std::uint32_t length)
 {
-    bool ime = m_mmio[0x208] & 1;
-    std::uint16_t ie_reg = *reinterpret_cast<std::uint16_t*>(m_mmio.data() + 0x200);
-    std::uint16_t if_reg = *reinterpret_cast<std::uint16_t*>(m_mmio.data() + 0x202);
-    return ime && (ie_reg & if_reg);
+    for (std::uint32_t at = addr; at < addr + length;)
+    {
+        const Page& page = m_write_pages[at >> PAGE_SHIFT];
+        std::uint32_t size = std::min(addr + length - at, page.mask + 1 - (at & page.mask));
+        if (page.video != PPU::Region::NONE)
+        {
+            m_ppu.written(page.video, page.base + (at & page.mask), size);
+        }
+        at += size;
+    }
+
+    for (std::uint32_t at = addr & ~((1 << CODE_PAGE_SHIFT) - 1); at < addr + length; at += 1 << CODE_PAGE_SHIFT)
+    {
+        const Page& page = m_write_pages[at >> PAGE_SHIFT];
+        if (page.code_page < 0) continue;
+
+        int code_page = page.code_page + ((at & page.mask) >> CODE_PAGE_SHIFT);
+        if (m_code_pages[code_page])
+        {
+            invalidate_code(code_page);
+        }
+    }
+}
+
+void Memory::invalidate_code(std::uint16_t page)
+{
+    m_code_pages[page] = false;
+    m_invalidated_code_pages.push_back(page);
 }
 
-void Memory::tick_components(int cycles)
+void Memory::dispatch_events()
 {
-    m_ppu.tick(cycles);
+    while (m_scheduler.pending())
+    {
+        auto [timestamp, event] = m_scheduler.pop();
+        switch (event)
+        {
+        case Scheduler::Event::HDRAW_END:
+            m_ppu.handle_event(event, timestamp);
+            break;
+        case Scheduler::Event::HBLANK_START:
+        {
+            m_ppu.handle_event(event, timestamp);
+            std::uint8_t line = m_mmio[VCOUNT];
+            if (line < 160) m_dma.trigger(Dma::Timing::HBLANK);
+            // video capture on dma 3 runs on lines 2 to 161
+            if ((line >= 2) && (line < 162)) m_dma.trigger(Dma::Timing::SPECIAL, 1 << 3);
+            break;
+        }
+        case Scheduler::Event::SCANLINE_END:
+            m_ppu.handle_event(event, timestamp);
+            if (m_mmio[VCOUNT] == 160) m_dma.trigger(Dma::Timing::VBLANK);
+            if (m_mmio[VCOUNT] == 162) m_dma.stop_video_capture();
+            break;
+        case Scheduler::Event::DMA:
+            // the cpu is stalled while the transfers run
+            m_scheduler.advance(m_dma.run());
+            break;
+        case Scheduler::Event::TIMER0_OVERFLOW:
+        case Scheduler::Event::TIMER1_OVERFLOW:
+        case Scheduler::Event::TIMER2_OVERFLOW:
+        case Scheduler::Event::TIMER3_OVERFLOW:
+            m_timer.overflow(static_cast<int>(event) - static_cast<int>(Scheduler::Event::TIMER0_OVERFLOW), timestamp);
+            break;
+        default: std::unreachable();
+        }
+    }
 }
 
 void Memory::reset_components() 
 {
-    m_ewram.clear();
-    m_iwram.clear();
+    std::fill(m_ewram.begin(), m_ewram.end(), 0);
+    std::fill(m_iwram.begin(), m_iwram.end(), 0);
     update_key_input(0xFFFF);
     m_mmio = {};
     // m_ppu = {m_mmio.data()};
@@ -61,5 +438,5 @@ void Memory::reset_components()
 
 FrameBuffer& Memory::get_frame() 
 {
-    return m_ppu.m_frame;
+    return m_ppu.frame();
 }
@@ -1,34 +1,150 @@
 #ifndef MEMORY_HPP
 #define MEMORY_HPP
 
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <span>
 #include <string>
+#include <utility>
 
+#include "backup.hpp"
+#include "dma.hpp"
+#include "fastmem.hpp"
+#include "interrupts.hpp"
+#include "io.hpp"
 #include "ppu.hpp"
+#include "scheduler.hpp"
 #include "timer.hpp"
 
 class Memory
 {
     public:
-        Memory() : m_ppu(std::span<std::uint16_t, 42>{reinterpret_cast<std::uint16_t*>(m_mmio.data()), 42}, m_mmio.data() + 0x202)
+        Memory() : m_ppu(std::span<std::uint16_t, 42>{reinterpret_cast<std::uint16_t*>(m_mmio.data()), 42}, m_interrupts, m_scheduler),
+            m_dma(*this, m_mmio.data(), m_scheduler), m_timer(m_mmio.data(), m_interrupts, m_scheduler)
         {
-            m_bios.resize(0x4000);
-            m_ewram.resize(0x40000);
-            m_iwram.resize(0x8000);
-            m_rom.resize(0x2000000);
-            m_sram.resize(0xFFFF);
+            m_storage.resize(STORAGE_SIZE);
             update_key_input(0xFFFF);
+            attach_storage(m_storage.data());
+            register_io();
+            m_interrupts.register_io(m_io);
+            m_ppu.register_io(m_io);
+            m_dma.register_io(m_io);
+            m_timer.register_io(m_io);
+            update_wait_states();
         }
+        ~Memory() { unload_rom(); }
+
+        Memory(const Memory&) = delete;
+        Memory& operator=(const Memory&) = delete;
 
         void load_bios();
         void load_rom(const std::string& rom_filepath);
+        std::string game_code() const;
+        //! hands changed save memory to the thread writing the battery file
+        void flush_backup() { m_backup.flush(); }
+        Backup& backup() noexcept { return m_backup; }
+        //! eeprom is mapped over the end of the last rom mirror
+        bool in_eeprom(std::uint32_t addr) const noexcept { return (addr >= m_eeprom_start) && (addr < 0x0E000000); }
+        //! moves guest memory into a reserved host window, returns false if it couldn't be set up
+        bool set_fastmem_enabled(bool enabled);
+        bool fastmem_enabled() const noexcept { return m_fastmem_base != nullptr; }
         void update_key_input(std::uint16_t v) noexcept { *reinterpret_cast<std::uint16_t*>(m_mmio.data() + 0x130) = v; };
         FrameBuffer& get_frame();
 
-        bool pending_interrupts();
+        Interrupts& interrupts() noexcept { return m_interrupts; }
+        PPU& ppu() noexcept { return m_ppu; }
+        //! an interrupt would be taken before the next instruction
+        bool irq_line() const noexcept { return m_interrupts.line(); }
+        bool interrupt_requested() const noexcept { return m_interrupts.requested(); }
+
+        //! set by a write to HALTCNT, the cpu stays halted until an enabled interrupt is requested
+        bool halted() const noexcept { return m_halted; }
+        void wake() noexcept { m_halted = false; }
 
-        void tick_components(int cycles);
+        void tick_components(int cycles)
+        {
+            m_scheduler.advance(cycles);
+            if (m_scheduler.pending()) [[unlikely]]
+            {
+                dispatch_events();
+            }
+        }
         void reset_components();
 
+        std::uint64_t cycles() const noexcept { return m_scheduler.now(); }
+        std::uint64_t next_event() const noexcept { return m_scheduler.next_timestamp(); }
+
+        int track_code(std::uint32_t addr);
+        bool has_invalidated_code() const noexcept { return !m_invalidated_code_pages.empty(); }
+        std::vector<std::uint16_t> take_invalidated_code() { return std::exchange(m_invalidated_code_pages, {}); }
+
+        //! host memory behind [addr, addr + length) if all of it is mapped contiguously, nullptr otherwise
+        std::uint8_t* host_range(std::uint32_t addr, std::uint32_t length, bool write);
+        //! invalidates translated code and marks video memory as changed after a write that bypassed write<T>
+        void range_written(std::uint32_t addr, std::uint32_t length);
+
+        //! cycles of a single access with the current wait states
+        template <typename T>
+        int access_cycles(std::uint32_t addr, bool sequential) const noexcept
+        {
+            std::uint8_t region = (addr >> 24) & 0xF;
+            if constexpr (sizeof(T) == 4)
+            {
+                return sequential ? m_cycles_s32[region] : m_cycles_n32[region];
+            }
+            return sequential ? m_cycles_s16[region] : m_cycles_n16[region];
+        }
+
+        //! cycles of a cpu data access, game pak accesses stop the prefetcher and anything else lets it run
+        template <typename T>
+        int data_cycles(std::uint32_t addr, bool sequential) noexcept
+        {
+            int cycles = access_cycles<T>(addr, sequential);
+            if (((addr >> 24) & 0xF) >= 0x8)
+            {
+                m_prefetch_cycles = 0;
+            }
+            else
+            {
+                prefetch_idle(cycles);
+            }
+            return cycles;
+        }
+
+        //! cycles of an opcode fetch, sequential fetches from the game pak come out of the prefetch buffer
+        int code_cycles(std::uint32_t addr, bool thumb, bool sequential) noexcept
+        {
+            std::uint8_t region = (addr >> 24) & 0xF;
+            int cycles = thumb ? (sequential ? m_cycles_s16[region] : m_cycles_n16[region])
+                : (sequential ? m_cycles_s32[region] : m_cycles_n32[region]);
+            if (!m_prefetch_enabled || (region < 0x8)) return cycles;
+
+            if (!sequential)
+            {
+                m_prefetch_cycles = 0;
+                return cycles;
+            }
+            // the buffer holds what the prefetcher fetched while the cpu was off the game pak bus
+            if (m_prefetch_cycles >= cycles)
+            {
+                m_prefetch_cycles -= cycles;
+                return 1;
+            }
+            cycles -= m_prefetch_cycles;
+            m_prefetch_cycles = 0;
+            return cycles;
+        }
+
+        //! cycles the cpu spends off the game pak bus
+        void prefetch_idle(int cycles) noexcept
+        {
+            if (m_prefetch_enabled)
+            {
+                m_prefetch_cycles = std::min(m_prefetch_cycles + cycles, m_prefetch_capacity);
+            }
+        }
+
         template <typename T>
         T read(std::uint32_t addr) 
         {
@@ -41,31 +157,26 @@ class Memory
                 addr &= ~1;
             }
 
-            switch ((addr >> 24) & 0xFF) {
-            case 0x00: return *reinterpret_cast<T*>(m_bios.data() + addr);
-            case 0x02: return *reinterpret_cast<T*>(m_ewram.data() + ((addr - 0x02000000) & 0x3FFFF));
-            case 0x03: return *reinterpret_cast<T*>(m_iwram.data() + ((addr - 0x03000000) & 0x7FFF));
-            case 0x04: return *reinterpret_cast<T*>(m_mmio.data() + ((addr - 0x04000000) & 0x3FF));
-            case 0x05: return *reinterpret_cast<T*>(m_ppu.m_pallete_ram.data() + ((addr - 0x05000000) & 0x3FF));
-            case 0x06:
+            if (m_fastmem_base) [[unlikely]]
             {
-                addr = (addr - 0x06000000) & 0x1FFFF;
-                if (addr >= 0x18000 && addr <= 0x1FFFF) 
+                return FastMem::load<T>(m_fastmem_base, addr);
+            }
+            return read_paged<T>(addr);
+        }
+
+        //! page table path, also completes loads that fault in the fastmem window
+        template <typename T>
+        T read_paged(std::uint32_t addr)
+        {
+            if (addr < PAGED_ADDRESS_END)
+            {
+                const Page& page = m_read_pages[addr >> PAGE_SHIFT];
+                if (page.base) [[likely]]
                 {
-                    return *reinterpret_cast<T*>(m_ppu.m_vram.data() + (addr - 0x8000));
+                    return *reinterpret_cast<T*>(page.base + (addr & page.mask));
                 }
-                return *reinterpret_cast<T*>(m_ppu.m_vram.data() + addr);
             }
-            case 0x07: return *reinterpret_cast<T*>(m_ppu.m_oam.data() + ((addr - 0x07000000) & 0x3FF));
-            case 0x08:
-            case 0x09:
-            case 0x0A:
-            case 0x0B:
-            case 0x0C:
-            case 0x0D: return *reinterpret_cast<T*>(m_rom.data() + ((addr - 0x08000000) & 0x1FFFFFF));
-            case 0x0E: return *reinterpret_cast<T*>(m_sram.data() - 0x0E000000);
-            }
-            return 0;
+            return read_slow<T>(addr);
         }
 
         template <typename T>
@@ -80,116 +191,224 @@ class Memory
                 addr &= ~1;
             }
 
-            switch ((addr >> 24) & 0xFF) 
+            if (addr < PAGED_ADDRESS_END)
             {
-            case 0x02:
-                *reinterpret_cast<T*>(m_ewram.data() + ((addr - 0x02000000) & 0x3FFFF)) = value;
-                break;
-            case 0x03:
-                *reinterpret_cast<T*>(m_iwram.data() + ((addr - 0x03000000) & 0x7FFF)) = value;
-                break;
-            case 0x04:
-                if constexpr (std::is_same_v<T, std::uint8_t>)
+                const Page& page = m_write_pages[addr >> PAGE_SHIFT];
+                if (page.base && ((sizeof(T) > 1) || page.byte_writes)) [[likely]]
                 {
-                    if (addr == 0x04000202)
+                    std::uint32_t offset = addr & page.mask;
+                    if (page.video != PPU::Region::NONE)
                     {
-                        printf("panda 0\n");
-                        exit(1);
+                        // games rewrite oam and the palette every frame, the same value changes nothing
+                        if (*reinterpret_cast<T*>(page.base + offset) != value)
+                        {
+                            *reinterpret_cast<T*>(page.base + offset) = value;
+                            m_ppu.written(page.video, page.base + offset, sizeof(T));
+                        }
+                        return;
                     }
-                }
-                else if (std::is_same_v<T, std::uint16_t>)
-                {
-                    if (addr == 0x04000202)
+                    *reinterpret_cast<T*>(page.base + offset) = value;
+                    if (page.code_page >= 0)
                     {
-                        *reinterpret_cast<T*>(m_mmio.data() + 0x202) &= ~value;
-                        break;
+                        int code_page = page.code_page + (offset >> CODE_PAGE_SHIFT);
+                        if (m_code_pages[code_page]) [[unlikely]]
+                        {
+                            invalidate_code(code_page);
+                        }
                     }
+                    return;
+                }
+            }
+            write_slow<T>(addr, value);
+        }
+
+    private:
+        static constexpr std::uint32_t VCOUNT = 0x006;
+        static constexpr std::uint32_t KEYINPUT = 0x130;
+        static constexpr std::uint32_t WAITCNT = 0x204;
+        static constexpr std::uint32_t HALTCNT = 0x301;
+
+        //! system control and keypad registers
+        void register_io();
+
+        void update_wait_states();
+        static constexpr int CODE_PAGE_SHIFT = 8;
+        static constexpr int EWRAM_CODE_PAGES = 0x40000 >> CODE_PAGE_SHIFT;
+        static constexpr int IWRAM_CODE_PAGES = 0x8000 >> CODE_PAGE_SHIFT;
+
+        // 16 KiB pages over the 28 bit bus, above that nothing is mapped
+        static constexpr int PAGE_SHIFT = 14;
+        static constexpr std::uint32_t PAGE_SIZE = 1 << PAGE_SHIFT;
+        static constexpr std::uint32_t PAGED_ADDRESS_END = 0x10000000;
+        static constexpr std::uint32_t PAGE_COUNT = PAGED_ADDRESS_END >> PAGE_SHIFT;
+
+        //! host memory behind a page, regions smaller than a page mirror through the mask.
+        //! pages without a base go through the slow path
+        struct Page
+        {
+            std::uint8_t* base = nullptr;
+            std::uint32_t mask = 0;
+            //! first code page of the page in m_code_pages, -1 for memory that can't hold blocks
+            std::int16_t code_page = -1;
+            bool byte_writes = true;
+            PPU::Region video = PPU::Region::NONE;
+        };
+
+        // bios, work ram and vram share one block so fastmem can back all of it with a single memfd
+        static constexpr std::size_t BIOS_OFFSET = 0;
+        static constexpr std::size_t EWRAM_OFFSET = BIOS_OFFSET + 0x4000;
+        static constexpr std::size_t IWRAM_OFFSET = EWRAM_OFFSET + 0x40000;
+        static constexpr std::size_t VRAM_OFFSET = IWRAM_OFFSET + 0x8000;
+        static constexpr std::size_t STORAGE_SIZE = VRAM_OFFSET + 0x18000;
+        // the rom is mapped from its file on its own, mirrored every 32 MiB
+        static constexpr std::uint32_t ROM_SIZE = 0x2000000;
+
+        void attach_storage(std::uint8_t* storage);
+        bool map_fastmem(FastMem& fastmem);
+        bool map_fastmem_rom(FastMem& fastmem);
+        void unload_rom();
+        static std::uint32_t fastmem_fault(void* context, std::uint32_t addr, int size);
+
+        void map_pages();
+        void map_region(std::uint32_t start, std::uint32_t end, std::uint8_t* host, std::uint32_t size, bool writable, bool byte_writes, int code_page = -1,
+            PPU::Region video = PPU::Region::NONE);
+
+        template <typename T>
+        [[gnu::noinline]] T read_slow(std::uint32_t addr)
+        {
+            switch ((addr >> 24) & 0xFF)
+            {
+            case 0x04: return m_io.read<T>((addr - 0x04000000) & 0x3FF);
+            case 0x08:
+            case 0x09:
+            case 0x0A:
+            case 0x0B:
+            case 0x0C:
+            case 0x0D:
+            {
+                if (addr >= m_eeprom_start) [[unlikely]]
+                {
+                    return static_cast<T>(m_backup.read_eeprom());
                 }
-                else
+                std::uint32_t offset = addr & (ROM_SIZE - 1);
+                if (offset + sizeof(T) <= m_rom.size())
                 {
-                    if (addr == 0x04000200)
-                    {
-                        *reinterpret_cast<T*>(m_mmio.data() + 0x200) = value & 0xFFFF;
-                        *reinterpret_cast<T*>(m_mmio.data() + 0x202) &= ~(value >> 16);
-                    }
-                    else if (addr == 0x04000202)
-                    {
-                        printf("panda 2\n");
-                        exit(1);
-                    }
+                    T value;
+                    std::memcpy(&value, m_rom.data() + offset, sizeof(T));
+                    return value;
                 }
-                *reinterpret_cast<T*>(m_mmio.data() + ((addr - 0x04000000) & 0x3FF)) = value;
+                // past the end the bus floats with the halfword address of the access
+                std::uint32_t open_bus = ((addr >> 1) & 0xFFFF) | ((((addr + 2) >> 1) & 0xFFFF) << 16);
+                return static_cast<T>(open_bus >> ((addr & 1) * 8));
+            }
+            // 8 bit bus, wider reads see the byte on every lane
+            case 0x0E:
+            case 0x0F: return static_cast<T>(m_backup.read(addr) * 0x01010101u);
+            }
+            return 0;
+        }
+
+        template <typename T>
+        [[gnu::noinline]] void write_slow(std::uint32_t addr, T value)
+        {
+            switch ((addr >> 24) & 0xFF) 
+            {
+            case 0x04:
+                m_io.write<T>((addr - 0x04000000) & 0x3FF, value);
                 break;
+            // wider writes to palette, vram and oam are mapped, only byte writes get here
             case 0x05:
-                if constexpr (std::is_same_v<T, std::uint8_t>) 
-                {
-                    std::uint16_t duplicated_halfword = (value << 8) | value;
-                    *reinterpret_cast<std::uint16_t*>(m_ppu.m_pallete_ram.data() + (((addr - 0x05000000) & 0x3FF) & ~1)) = duplicated_halfword;
-                } 
-                else 
-                {
-                    *reinterpret_cast<T*>(m_ppu.m_pallete_ram.data() + ((addr - 0x05000000) & 0x3FF)) = value;
-                }
+            {
+                std::uint16_t duplicated_halfword = (value << 8) | value;
+                std::uint8_t* host = m_ppu.m_pallete_ram.data() + (((addr - 0x05000000) & 0x3FF) & ~1);
+                *reinterpret_cast<std::uint16_t*>(host) = duplicated_halfword;
+                m_ppu.written(PPU::Region::PALETTE, host, 2);
                 break;
+            }
             case 0x06: 
             {
-                if constexpr (std::is_same_v<T, std::uint8_t>) 
+                addr = (addr - 0x06000000) & 0x1FFFF;
+                if (addr >= 0x18000)
                 {
-                    addr = (addr - 0x06000000) & 0x1FFFF;
-                    if (addr >= 0x18000)
-                    {
-                        addr -= 0x8000;
-                    }
-                    if (addr >= 0x14000)
-                    {
-                        break;
-                    }
-                    std::uint32_t bg_vram_size = 0x10000;
-                    if ((m_ppu.m_mmio[PPU::REG_DISPCNT] & 7) >= 3)
-                    {
-                        bg_vram_size += 0x14000;
-                    }
-                    if (addr < bg_vram_size) 
-                    {
-                        std::uint16_t duplicated_halfword = (value << 8) | value;
-                        *reinterpret_cast<std::uint16_t*>(m_ppu.m_vram.data() + (addr & ~1)) = duplicated_halfword;
-                    }
-                    break;
+                    addr -= 0x8000;
                 }
-                else 
+                if (addr >= 0x14000)
                 {
-                    addr = (addr - 0x06000000) & 0x1FFFF;
-                    if (addr >= 0x18000)
-                    {
-                        addr -= 0x8000;
-                    }
-                    *reinterpret_cast<T*>(m_ppu.m_vram.data() + addr) = value;
                     break;
                 }
+                std::uint32_t bg_vram_size = 0x10000;
+                if ((m_ppu.m_mmio[PPU::REG_DISPCNT] & 7) >= 3)
+                {
+                    bg_vram_size += 0x14000;
+                }
+                if (addr < bg_vram_size) 
+                {
+                    std::uint16_t duplicated_halfword = (value << 8) | value;
+                    *reinterpret_cast<std::uint16_t*>(m_ppu.m_vram.data() + (addr & ~1)) = duplicated_halfword;
+                    m_ppu.written(PPU::Region::VRAM, m_ppu.m_vram.data() + (addr & ~1), 2);
+                }
                 break;
             }
-            case 0x07:
-                if constexpr (!std::is_same_v<T, std::uint8_t>) 
+            case 0x0D:
+                if (addr >= m_eeprom_start)
                 {
-                    *reinterpret_cast<T*>(m_ppu.m_oam.data() + ((addr - 0x07000000) & 0x3FF)) = value;
+                    m_backup.write_eeprom(static_cast<std::uint16_t>(value));
                 }
                 break;
             case 0x0E:
-                *reinterpret_cast<T*>(m_sram.data() - 0x0E000000) = value;
+            case 0x0F:
+                m_backup.write(addr, static_cast<std::uint8_t>(value));
                 break;
             }
         }
 
-    private:
-        std::vector<std::uint8_t> m_bios;
-        std::vector<std::uint8_t> m_ewram;
-        std::vector<std::uint8_t> m_iwram;
-        std::vector<std::uint8_t> m_rom;
-        std::vector<std::uint8_t> m_sram;
-        std::array<std::uint8_t, 0x400> m_mmio{};
+        void dispatch_events();
+        void invalidate_code(std::uint16_t page);
+
+        // heap backing while fastmem is off
+        std::vector<std::uint8_t> m_storage;
+        std::unique_ptr<FastMem> m_fastmem;
+        const std::uint8_t* m_fastmem_base = nullptr;
+
+        std::span<std::uint8_t> m_bios;
+        std::span<std::uint8_t> m_ewram;
+        std::span<std::uint8_t> m_iwram;
+        // read only mapping of the rom file, the page cache shares it between instances
+        std::span<std::uint8_t> m_rom;
+        int m_rom_fd = -1;
+        // the last partial page of the rom followed by open bus
+        std::array<std::uint8_t, PAGE_SIZE> m_rom_tail{};
+        // where the rom is read into on hosts without mmap
+        std::vector<std::uint8_t> m_rom_buffer;
+        Backup m_backup;
+        //! start of the eeprom window, all of 0x0D for roms up to 16 MiB and its last 256 bytes above that
+        std::uint32_t m_eeprom_start = 0x0E000000;
+        std::array<std::uint8_t, Io::SIZE> m_mmio{};
+        Io m_io{m_mmio.data()};
+        Interrupts m_interrupts{m_mmio.data()};
+
+        std::vector<Page> m_read_pages;
+        std::vector<Page> m_write_pages;
+
+        // pages of EWRAM followed by IWRAM that hold decoded instructions
+        std::array<bool, EWRAM_CODE_PAGES + IWRAM_CODE_PAGES> m_code_pages{};
+        std::vector<std::uint16_t> m_invalidated_code_pages;
+        bool m_halted = false;
+
+        // access cycles indexed by the top nibble of the address, rebuilt when WAITCNT is written
+        std::array<std::uint8_t, 16> m_cycles_n16{};
+        std::array<std::uint8_t, 16> m_cycles_s16{};
+        std::array<std::uint8_t, 16> m_cycles_n32{};
+        std::array<std::uint8_t, 16> m_cycles_s32{};
+        bool m_prefetch_enabled = false;
+        //! game pak cycles the prefetcher has fetched ahead, up to eight halfwords
+        int m_prefetch_cycles = 0;
+        int m_prefetch_capacity = 0;
 
+        Scheduler m_scheduler;
         PPU m_ppu;
-        Timer timer;
+        Dma m_dma;
+        Timer m_timer;
 };
 
 #endif
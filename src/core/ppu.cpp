@@ -1,7 +1,24 @@
 #include "ppu.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 const std::uint8_t FRAME_HEIGHT = 160;
 const std::uint8_t FRAME_WIDTH = 240;
+const std::uint8_t MODE_5_HEIGHT = 128;
+const std::uint8_t MODE_5_WIDTH = 160;
+
+const int OBJ_CYCLES = 1210;
+const int OBJ_CYCLES_HBLANK_FREE = 954;
+
+const std::uint32_t HDRAW_END_CYCLES = 960;
+const std::uint32_t HBLANK_START_CYCLES = 1007;
+const std::uint32_t SCANLINE_CYCLES = 1232;
 
 std::uint16_t PPU::get_tile_offset(int tx, int ty, bool bg_reg_64x64) const noexcept
 {
@@ -37,20 +54,17 @@ std::uint16_t PPU::get_sprite_size(std::uint8_t shape) const noexcept
     }
 }
 
-void PPU::render_backdrop()
+std::uint32_t PPU::bg_order(int bg) const noexcept
 {
-    std::uint16_t backdrop_color = *reinterpret_cast<std::uint16_t*>(m_pallete_ram.data());
-    for (int i = 0; i < FRAME_WIDTH; i++)
-    {
-        m_frame[m_mmio[REG_VCOUNT]][i] = backdrop_color;
-    }
+    return ((m_mmio[REGS_BGCNT + bg] & 3) << 3) | (LAYER_BG0 + bg);
 }
 
-void PPU::render_text_bg(std::uint16_t bgcnt, std::uint16_t bghofs, std::uint16_t bgvofs) 
+void PPU::render_text_bg(int bg)
 {
+    std::uint16_t bgcnt = m_mmio[REGS_BGCNT + bg];
     auto tm_width = 32 * (1 + ((bgcnt >> 0xE) & 1));
     auto tm_height = 32 * (1 + ((bgcnt >> 0xF) & 1));
-    auto tile_data_base = m_vram.data() + (((bgcnt >> 2) & 3) * 0x4000);
+    std::uint32_t tile_data_base = ((bgcnt >> 2) & 3) * 0x4000;
     auto tile_map_base = m_vram.data() + (((bgcnt >> 0x8) & 0x1F) * 0x800);
     bool bg_reg_64x64 = ((bgcnt >> 0xE) & 3) == 3;
     bool color_pallete = (bgcnt >> 7) & 1;
@@ -62,294 +76,546 @@ void PPU::render_text_bg(std::uint16_t bgcnt, std::uint16_t bghofs, std::uint16_
         std::exit(1);
     }
 
-    auto combined_vofs = bgvofs + m_mmio[REG_VCOUNT];
-    auto tx = ((bghofs & ~7) / 8) & (tm_width - 1);
-    auto ty = ((combined_vofs & ~7) / 8) & (tm_height - 1);
-    auto scanline_x = 0;
+    auto bghofs = m_mmio[REGS_OFS + bg * 2] & 0x1FF;
+    auto bgvofs = m_mmio[REGS_OFS + bg * 2 + 1] & 0x1FF;
+    auto combined_vofs = (bgvofs + m_mmio[REG_VCOUNT]) & ((tm_height * 8) - 1);
+    auto ty = combined_vofs / 8;
+    auto tile_scanline = combined_vofs & 7;
+    const auto* pallete = reinterpret_cast<const std::uint16_t*>(m_pallete_ram.data());
+    std::uint32_t order = bg_order(bg) << LINE_ORDER_SHIFT;
+    LineBuffer& line = m_lines[LAYER_BG0 + bg];
 
-    while (true)
+    for (int scanline_x = 0, combined_hofs = bghofs; scanline_x < LINE_WIDTH; combined_hofs = (combined_hofs & ~7) + 8)
     {
+        auto tx = (combined_hofs / 8) & (tm_width - 1);
         auto screen_entry = *reinterpret_cast<std::uint16_t*>(tile_map_base + get_tile_offset(tx, ty, bg_reg_64x64));
         auto tile_id = screen_entry & 0x3FF;
         auto pallete_bank = ((screen_entry >> 0xC) & 0xF) << 4;
         bool h_flip = (screen_entry >> 0xA) & 1;
         bool v_flip = (screen_entry >> 0xB) & 1;
 
-        auto tile_scanline = combined_vofs - (combined_vofs & ~7);
-        auto tile = tile_data_base 
-            + (tile_id * (0x20 << color_pallete)) 
-            + ((v_flip ? 7 - tile_scanline : tile_scanline) * (4 << color_pallete));
-
-        int start, end, step;
-        if (h_flip) 
+        // backgrounds can't reach the object tiles, what lies past them reads as transparent
+        std::uint32_t tile_offset = tile_data_base + (tile_id * (0x20 << color_pallete));
+        const std::uint8_t* tile_row = EMPTY_TILE_ROW.data();
+        if (tile_offset < 0x10000)
         {
-            start = 3;
-            end = -1;
-            step = -1;
-        } 
-        else 
-        {
-            start = 0;
-            end = 4;
-            step = 1;
+            tile_row = m_tile_cache.tile(m_vram, tile_offset, color_pallete) + ((v_flip ? 7 - tile_scanline : tile_scanline) * 8);
         }
 
-        for (int i = start; i != end; i += step) 
+        for (int px = combined_hofs & 7; (px < 8) && (scanline_x < LINE_WIDTH); px++, scanline_x++)
         {
-            for (int nibble = h_flip; nibble != (!h_flip + step); nibble += step) 
+            int col = h_flip ? 7 - px : px;
+            std::uint8_t pallete_id = tile_row[col];
+            if (pallete_id == 0)
             {
-                if (scanline_x >= FRAME_WIDTH) return;
-
-                int px = i * 2 + nibble;
-                if (!scanline_x && (px < (bghofs - (bghofs & ~7)))) continue;
-
-                std::uint8_t pallete_id;
-                std::uint16_t transparent_color;
-                
-                if (color_pallete)
-                {
-                    pallete_id = tile[px];
-                    transparent_color = *reinterpret_cast<std::uint16_t*>(m_pallete_ram.data());
-                }
-                else
-                {
-                    pallete_id = pallete_bank | ((tile[i] >> (nibble * 4)) & 0x0F);
-                    transparent_color = *reinterpret_cast<std::uint16_t*>(m_pallete_ram.data() + (pallete_bank * 2));
-                }
-                
-                std::uint16_t pixel_color = *reinterpret_cast<std::uint16_t*>(m_pallete_ram.data() + (pallete_id * 2));
-                if (pixel_color != transparent_color)
-                {
-                    m_frame[m_mmio[REG_VCOUNT]][scanline_x] = pixel_color;
-                }
-                scanline_x++;
+                line[scanline_x] = LINE_TRANSPARENT;
+                continue;
             }
+            line[scanline_x] = order | (pallete[color_pallete ? pallete_id : (pallete_bank | pallete_id)] & 0x7FFF);
         }
-
-        tx = (tx + 1) & (tm_width - 1);
     }
+    m_line_layers |= 1 << (LAYER_BG0 + bg);
 }
 
-void PPU::render_sprite(std::uint64_t sprite_entry, bool is_dim_1)
+void PPU::step_affine_line(std::int32_t x, std::int32_t y, std::int32_t dx, std::int32_t dy, int size, bool wrap) noexcept
 {
-    std::uint8_t y_coord = sprite_entry & 0xFF;
-    std::uint16_t sprite_size = get_sprite_size((((sprite_entry >> 0xE) & 3) << 2) | ((sprite_entry >> (16 + 0xE)) & 3));
-    std::uint8_t sprite_height = sprite_size & 0xFF;
-
-    if (((y_coord + sprite_height) > m_mmio[REG_VCOUNT]) && (m_mmio[REG_VCOUNT] >= y_coord))
+    int col = 0;
+#ifdef __SSE2__
+    // four columns at a time, each lane starts a column apart and steps by four times pa and pc
+    __m128i tex_x = _mm_setr_epi32(x, x + dx, x + (dx * 2), x + (dx * 3));
+    __m128i tex_y = _mm_setr_epi32(y, y + dy, y + (dy * 2), y + (dy * 3));
+    const __m128i step_x = _mm_set1_epi32(dx * 4);
+    const __m128i step_y = _mm_set1_epi32(dy * 4);
+    const __m128i size_mask = _mm_set1_epi32(size - 1);
+    for (; col < LINE_WIDTH; col += 4)
     {
-        std::uint8_t sprite_length = (sprite_size >> 8) & 0xFF;
-        std::uint16_t x_coord = (sprite_entry >> 16) & 0x1FF;
-        auto tm_height = (sprite_height & ~7) / 8;
-        auto tm_length = (sprite_length & ~7) / 8;
-        auto base_tile_number = (sprite_entry >> 32) & 0x3FF;
-        auto tile_scanline = (m_mmio[REG_VCOUNT] - y_coord) - ((m_mmio[REG_VCOUNT] - y_coord) & ~7);
-        bool is_256_color_pallete = (sprite_entry >> 0xD) & 1;
-
-        if ((sprite_entry >> 0xC) & 1)
+        __m128i map_x = _mm_srai_epi32(tex_x, 8);
+        __m128i map_y = _mm_srai_epi32(tex_y, 8);
+        if (wrap)
         {
-            // printf("ENABLE MOSAIC FOR THIS SPRITE!\n");
-            // exit(1);
+            map_x = _mm_and_si128(map_x, size_mask);
+            map_y = _mm_and_si128(map_y, size_mask);
         }
-
-        for (int tx = 0; tx < tm_length; tx++)
+        else
+        {
+            // anything with bits outside the map size is off the map, negative values included
+            __m128i outside = _mm_or_si128(_mm_andnot_si128(size_mask, map_x), _mm_andnot_si128(size_mask, map_y));
+            map_x = _mm_or_si128(map_x, _mm_cmpeq_epi32(_mm_cmpeq_epi32(outside, _mm_setzero_si128()), _mm_setzero_si128()));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(m_affine_x.data() + col), map_x);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(m_affine_y.data() + col), map_y);
+        tex_x = _mm_add_epi32(tex_x, step_x);
+        tex_y = _mm_add_epi32(tex_y, step_y);
+    }
+#endif
+    for (; col < LINE_WIDTH; col++)
+    {
+        std::int32_t map_x = (x + (dx * col)) >> 8;
+        std::int32_t map_y = (y + (dy * col)) >> 8;
+        if (wrap)
+        {
+            map_x &= size - 1;
+            map_y &= size - 1;
+        }
+        else if ((map_x | map_y) & ~(size - 1))
         {
-            auto ty = ((m_mmio[REG_VCOUNT] - y_coord) & ~7) / 8;
-            auto tile = m_vram.data() + 0x010000
-                + ((base_tile_number + tx + (ty * (is_dim_1 ? tm_height : 32))) * (0x20 << is_256_color_pallete))
-                + (tile_scanline * (4 << is_256_color_pallete));
+            map_x = -1;
+        }
+        m_affine_x[col] = map_x;
+        m_affine_y[col] = map_y;
+    }
+}
 
-            for (int i = 0; i < 4; i++)
-            {
-                for (int nibble = 0; nibble < 2; nibble++)
-                {
-                    int px = tx * 8 + i * 2 + nibble;
-                    if ((x_coord + px) >= 240) return;
-
-                    std::uint8_t pallete_id;
-                    std::uint16_t transparent_color;
-                    
-                    if (is_256_color_pallete)
-                    {
-                        pallete_id = tile[px];
-                        transparent_color = *reinterpret_cast<std::uint16_t*>(m_pallete_ram.data() + 0x200);
-                    }
-                    else
-                    {
-                        auto pallete_bank = ((sprite_entry >> (32 + 0xC)) & 0xF) << 4;
-                        pallete_id = pallete_bank | ((tile[i] >> (nibble * 4)) & 0x0F);
-                        transparent_color = *reinterpret_cast<std::uint16_t*>(m_pallete_ram.data() + 0x200 + (pallete_bank * 2));
-                    }
-
-                    std::uint16_t pixel_color = *reinterpret_cast<std::uint16_t*>(m_pallete_ram.data() + 0x200 + (pallete_id * 2));
-                    if (pixel_color != transparent_color)
-                    {
-                        m_frame[m_mmio[REG_VCOUNT]][x_coord + px] = pixel_color;
-                    }
-                }
-            }
+void PPU::render_affine_bg(int bg)
+{
+    // the mosaic bit is ignored, the layer is drawn without it
+    std::uint16_t bgcnt = m_mmio[REGS_BGCNT + bg];
+
+    // 16 to 128 tiles a side, one byte per map entry and every tile 256 colour
+    int size = 128 << ((bgcnt >> 0xE) & 3);
+    int size_shift = std::countr_zero(static_cast<unsigned>(size / 8));
+    const std::uint8_t* tile_data_base = m_vram.data() + (((bgcnt >> 2) & 3) * 0x4000);
+    const std::uint8_t* tile_map_base = m_vram.data() + (((bgcnt >> 0x8) & 0x1F) * 0x800);
+    bool wrap = (bgcnt >> 0xD) & 1;
+
+    int affine = bg - 2;
+    auto regs = m_mmio.data() + REGS_AFFINE + (affine * AFFINE_REGS_SIZE);
+    step_affine_line(m_affine_ref_x[affine], m_affine_ref_y[affine], static_cast<std::int16_t>(regs[0]), static_cast<std::int16_t>(regs[2]), size, wrap);
+
+    const auto* pallete = reinterpret_cast<const std::uint16_t*>(m_pallete_ram.data());
+    std::uint32_t order = bg_order(bg) << LINE_ORDER_SHIFT;
+    LineBuffer& line = m_lines[LAYER_BG0 + bg];
+    for (int col = 0; col < LINE_WIDTH; col++)
+    {
+        std::int32_t map_x = m_affine_x[col];
+        std::int32_t map_y = m_affine_y[col];
+        if (map_x < 0)
+        {
+            line[col] = LINE_TRANSPARENT;
+            continue;
         }
+        std::uint8_t tile_id = tile_map_base[((map_y >> 3) << size_shift) + (map_x >> 3)];
+        std::uint8_t pallete_id = tile_data_base[(tile_id * 64) + ((map_y & 7) * 8) + (map_x & 7)];
+        line[col] = pallete_id ? (order | (pallete[pallete_id] & 0x7FFF)) : LINE_TRANSPARENT;
     }
+    m_line_layers |= 1 << (LAYER_BG0 + bg);
 }
 
-std::array<std::uint16_t, 4> PPU::bg_priority_list() const noexcept
+std::int32_t PPU::reference_point(int affine, bool y) const noexcept
 {
-    std::array<std::uint16_t, 4> priority_list;
+    auto reg = m_mmio.data() + REGS_AFFINE + (affine * AFFINE_REGS_SIZE) + 4 + (y * 2);
+    std::uint32_t value = reg[0] | (static_cast<std::uint32_t>(reg[1]) << 16);
+    // 28 bit signed, 20.8 fixed point
+    return static_cast<std::int32_t>(value << 4) >> 4;
+}
 
-    for (int i = 0; i < 4; i++)
+void PPU::latch_reference_points() noexcept
+{
+    for (int affine = 0; affine < 2; affine++)
     {
-        priority_list[i] = m_mmio[REGS_BGCNT + i] | (i << 4);
+        m_affine_ref_x[affine] = reference_point(affine, false);
+        m_affine_ref_y[affine] = reference_point(affine, true);
     }
+}
 
-    for (int i = 1; i < 4; i++)
+void PPU::update_objects()
+{
+    if (m_oam_dirty.none()) return;
+
+    for (int i = 0; i < 128; i++)
     {
-        int j = i - 1;
-        while ((j >= 0) && ((priority_list[j] & 3) > (priority_list[j + 1] & 3)))
+        if (!m_oam_dirty[i]) continue;
+
+        Object& object = m_objects[i];
+        set_object_lines(i, object, false);
+
+        std::uint64_t entry = *reinterpret_cast<std::uint64_t*>(m_oam.data() + (i * 8));
+        std::uint8_t shape = (entry >> 0xE) & 3;
+        object.affine = (entry >> 8) & 1;
+        object.mode = (entry >> 0xA) & 3;
+        // the disable bit is the double size bit of affine objects, the object window isn't drawn
+        object.visible = (object.affine || !((entry >> 9) & 1)) && (shape != 3) && (object.mode < 2);
+        if (object.visible)
         {
-            auto temp = priority_list[j];
-            priority_list[j] = priority_list[j + 1];
-            priority_list[j + 1] = temp;
-            j--;
+            std::uint16_t sprite_size = get_sprite_size((shape << 2) | ((entry >> (16 + 0xE)) & 3));
+            object.width = (sprite_size >> 8) & 0xFF;
+            object.height = sprite_size & 0xFF;
         }
+        bool double_size = object.affine && ((entry >> 9) & 1);
+        object.box_width = object.width << double_size;
+        object.box_height = object.height << double_size;
+        object.y = entry & 0xFF;
+        object.x = (entry >> 16) & 0x1FF;
+        if (object.x >= LINE_WIDTH)
+        {
+            object.x -= 0x200;
+        }
+        object.is_256_color = (entry >> 0xD) & 1;
+        object.h_flip = !object.affine && ((entry >> (16 + 0xC)) & 1);
+        object.v_flip = !object.affine && ((entry >> (16 + 0xD)) & 1);
+        object.affine_group = (entry >> (16 + 9)) & 0x1F;
+        object.tile = (entry >> 32) & 0x3FF;
+        object.priority = (entry >> (32 + 0xA)) & 3;
+        object.pallete_bank = ((entry >> (32 + 0xC)) & 0xF) << 4;
+
+        set_object_lines(i, object, true);
+    }
+    m_oam_dirty.reset();
+}
+
+void PPU::set_object_lines(int index, const Object& object, bool visible) noexcept
+{
+    if (!object.visible) return;
+
+    // objects wrap around the bottom of the 256 line screen space
+    for (int row = 0; row < object.box_height; row++)
+    {
+        int y = (object.y + row) & 0xFF;
+        if (y >= FRAME_HEIGHT) continue;
+
+        std::uint64_t bit = std::uint64_t(1) << (index & 63);
+        std::uint64_t& word = m_object_lines[y][index >> 6];
+        word = visible ? (word | bit) : (word & ~bit);
     }
+}
 
-    return priority_list;
+std::uint8_t PPU::object_pixel(const Object& object, int x, int y, bool is_dim_1) noexcept
+{
+    // 256 colour tiles take two tile numbers, one dimensional mapping puts the rows back to back
+    std::uint32_t tile_number = object.tile + ((y / 8) * (is_dim_1 ? ((object.width / 8) << object.is_256_color) : 32)) + ((x / 8) << object.is_256_color);
+    return m_tile_cache.tile(m_vram, 0x010000 + ((tile_number & 0x3FF) * 0x20), object.is_256_color)[((y & 7) * 8) + (x & 7)];
 }
 
-void PPU::draw_scanline_tilemap_0() 
+void PPU::render_object(const Object& object, bool is_dim_1, LineBuffer& line)
 {
-    auto bg_list = bg_priority_list();
+    std::uint32_t pixel_base = ((object.priority << 3) | LAYER_OBJ) << LINE_ORDER_SHIFT;
+    if (object.mode == 1)
+    {
+        pixel_base |= LINE_SEMI_TRANSPARENT;
+    }
+    const auto* pallete = reinterpret_cast<const std::uint16_t*>(m_pallete_ram.data() + 0x200);
+    int row = (m_mmio[REG_VCOUNT] - object.y) & 0xFF;
+    int start = std::max(0, -static_cast<int>(object.x));
+    int end = std::min<int>(object.box_width, LINE_WIDTH - object.x);
+
+    // affine objects sample their sprite around its centre, pa-pd are in the attribute 3 of four entries
+    std::int32_t pa = 0x100, pc = 0;
+    std::int32_t tex_x = 0, tex_y = 0;
+    if (object.affine)
+    {
+        auto params = reinterpret_cast<const std::int16_t*>(m_oam.data() + (object.affine_group * 32) + 6);
+        pa = params[0];
+        std::int32_t pb = params[4];
+        pc = params[8];
+        std::int32_t pd = params[12];
+        std::int32_t box_x = start - (object.box_width / 2);
+        std::int32_t box_y = row - (object.box_height / 2);
+        tex_x = (pa * box_x) + (pb * box_y) + ((object.width / 2) << 8);
+        tex_y = (pc * box_x) + (pd * box_y) + ((object.height / 2) << 8);
+    }
+    else
+    {
+        tex_y = (object.v_flip ? object.height - 1 - row : row) << 8;
+    }
 
-    for (int i = 7; i >= 0; i--)
+    for (int col = start; col < end; col++, tex_x += pa, tex_y += pc)
     {
-        if (i & 1)
+        int x = object.affine ? (tex_x >> 8) : (object.h_flip ? object.width - 1 - col : col);
+        int y = tex_y >> 8;
+        if ((x < 0) || (x >= object.width) || (y < 0) || (y >= object.height)) continue;
+
+        std::uint8_t pallete_id = object_pixel(object, x, y, is_dim_1);
+        if (pallete_id == 0) continue;
+
+        // objects come in oam order, only a higher priority replaces a pixel so lower entries stay
+        // in front of later ones of the same priority whatever their colour and flags
+        std::uint32_t pixel = pixel_base | (pallete[object.is_256_color ? pallete_id : (object.pallete_bank | pallete_id)] & 0x7FFF);
+        std::uint32_t& front = line[object.x + col];
+        if ((pixel >> LINE_ORDER_SHIFT) < (front >> LINE_ORDER_SHIFT))
         {
-            auto list_idx = (i - 1) / 2;
-            auto background_id = (bg_list[list_idx] >> 4) & 3;
-            bool should_display_bg = (m_mmio[REG_DISPCNT] >> (8 + background_id)) & 1;
-            if (should_display_bg)
-            {
-                render_text_bg(bg_list[list_idx], m_mmio[REGS_OFS + background_id * 2] & 0x3FF, m_mmio[REGS_OFS + background_id * 2 + 1] & 0x3FF);
-            }
+            front = pixel;
+        }
+    }
+}
+
+void PPU::render_sprites()
+{
+    update_objects();
+
+    LineBuffer& line = m_lines[LAYER_OBJ];
+    line.fill(LINE_TRANSPARENT);
+    m_line_layers |= 1 << LAYER_OBJ;
+
+    bool is_dim_1 = (m_mmio[REG_DISPCNT] >> 6) & 1;
+    // bitmap modes take the lower half of object vram
+    bool is_bitmap = (m_mmio[REG_DISPCNT] & 7) >= 3;
+    // objects get the whole line unless hblank is kept free for them to be changed in
+    int cycles = ((m_mmio[REG_DISPCNT] >> 5) & 1) ? OBJ_CYCLES_HBLANK_FREE : OBJ_CYCLES;
+    for (int word = 0; word < 2; word++)
+    {
+        for (std::uint64_t bits = m_object_lines[m_mmio[REG_VCOUNT]][word]; bits != 0; bits &= bits - 1)
+        {
+            const Object& object = m_objects[(word * 64) + std::countr_zero(bits)];
+            if (is_bitmap && (object.tile < 512)) continue;
+
+            cycles -= object.affine ? (10 + (object.box_width * 2)) : object.width;
+            if (cycles < 0) return;
+
+            render_object(object, is_dim_1, line);
         }
-        else if ((m_mmio[REG_DISPCNT] >> 0xC) & 1)
+    }
+}
+
+void PPU::draw_scanline_tilemap_0() 
+{
+    for (int bg = 0; bg < 4; bg++)
+    {
+        if ((m_mmio[REG_DISPCNT] >> (8 + bg)) & 1)
         {
-            for (int j = 127; j >= 0; j--)
-            {
-                auto sprite_entry = *reinterpret_cast<std::uint64_t*>(m_oam.data() + j * 8);
-                auto priority = (sprite_entry >> (32 + 0xA)) & 3;
-                if ((i / 2) == priority)
-                {
-                    render_sprite(sprite_entry, (m_mmio[REG_DISPCNT] >> 6) & 1);    
-                }
-            }
+            render_text_bg(bg);
         }
     }
 }
 
 void PPU::draw_scanline_tilemap_1() 
 {
-    printf("scanline tilemap 1\n");
-    std::exit(1);
+    for (int bg = 0; bg < 2; bg++)
+    {
+        if ((m_mmio[REG_DISPCNT] >> (8 + bg)) & 1)
+        {
+            render_text_bg(bg);
+        }
+    }
+    if ((m_mmio[REG_DISPCNT] >> 10) & 1)
+    {
+        render_affine_bg(2);
+    }
 }
 
 void PPU::draw_scanline_tilemap_2() 
 {
-    printf("scanline tilemap 2\n");
-    std::exit(1);
+    for (int bg = 2; bg < 4; bg++)
+    {
+        if ((m_mmio[REG_DISPCNT] >> (8 + bg)) & 1)
+        {
+            render_affine_bg(bg);
+        }
+    }
 }
 
 void PPU::draw_scanline_bitmap_3() 
 {
-    for (int col = 0; col < FRAME_WIDTH; col++) 
-    {
-        m_frame[m_mmio[REG_VCOUNT]][col] = *reinterpret_cast<uint16_t*>(m_vram.data() + (m_mmio[REG_VCOUNT] * (FRAME_WIDTH * 2)) + (col * 2));
-    }
+    if (!((m_mmio[REG_DISPCNT] >> 10) & 1)) return;
+
+    auto vram_line = reinterpret_cast<const std::uint16_t*>(m_vram.data()) + (m_mmio[REG_VCOUNT] * FRAME_WIDTH);
+    expand_line(vram_line, FRAME_WIDTH, bg_order(2) << LINE_ORDER_SHIFT, m_lines[LAYER_BG2].data());
+    m_line_layers |= 1 << LAYER_BG2;
 }
 
 void PPU::draw_scanline_bitmap_4()
 {
+    if (!((m_mmio[REG_DISPCNT] >> 10) & 1)) return;
+
     std::uint8_t* vram_base_ptr = m_vram.data() + (((m_mmio[REG_DISPCNT] >> 4) & 1) * 0xA000);
-    for (int col = 0; col < FRAME_WIDTH; col++) 
+    const auto* pallete = reinterpret_cast<const std::uint16_t*>(m_pallete_ram.data());
+    lookup_line(vram_base_ptr + (m_mmio[REG_VCOUNT] * FRAME_WIDTH), pallete, FRAME_WIDTH, bg_order(2) << LINE_ORDER_SHIFT, m_lines[LAYER_BG2].data());
+    m_line_layers |= 1 << LAYER_BG2;
+}
+
+void PPU::draw_scanline_bitmap_5() 
+{
+    // 160x128 with two pages like mode 4, the rest of the screen shows what's behind bg2
+    if (!((m_mmio[REG_DISPCNT] >> 10) & 1) || (m_mmio[REG_VCOUNT] >= MODE_5_HEIGHT)) return;
+
+    auto vram_line = reinterpret_cast<const std::uint16_t*>(m_vram.data() + (((m_mmio[REG_DISPCNT] >> 4) & 1) * 0xA000)) + (m_mmio[REG_VCOUNT] * MODE_5_WIDTH);
+    LineBuffer& line = m_lines[LAYER_BG2];
+    expand_line(vram_line, MODE_5_WIDTH, bg_order(2) << LINE_ORDER_SHIFT, line.data());
+    std::fill(line.begin() + MODE_5_WIDTH, line.end(), LINE_TRANSPARENT);
+    m_line_layers |= 1 << LAYER_BG2;
+}
+
+bool PPU::is_direct_line() const noexcept
+{
+    // mode 3 with only bg2 on, no windows, mosaic or colour effects
+    return ((m_mmio[REG_DISPCNT] & 0xFF87) == ((1 << 10) | 3)) && !((m_mmio[REGS_BGCNT + 2] >> 6) & 1)
+        && !(m_mmio[REG_BLDCNT] & 0xC0);
+}
+
+FrameBuffer& PPU::frame() noexcept
+{
+    if (m_direct_frame)
     {
-        std::uint8_t pallete_idx = *(vram_base_ptr + (m_mmio[REG_VCOUNT] * FRAME_WIDTH) + col);
-        m_frame[m_mmio[REG_VCOUNT]][col] = *reinterpret_cast<uint16_t*>(m_pallete_ram.data() + pallete_idx * 2);
+        return *reinterpret_cast<FrameBuffer*>(m_vram.data());
     }
+    return m_frame;
 }
 
-void PPU::draw_scanline_bitmap_5() 
+void PPU::schedule_scanline(std::uint64_t line_start)
 {
-    printf("scanline bitmap 5\n");
-    std::exit(1);
+    m_scheduler.schedule(Scheduler::Event::HDRAW_END, line_start + HDRAW_END_CYCLES);
+    m_scheduler.schedule(Scheduler::Event::HBLANK_START, line_start + HBLANK_START_CYCLES);
+    m_scheduler.schedule(Scheduler::Event::SCANLINE_END, line_start + SCANLINE_CYCLES);
 }
 
-void PPU::tick(int cycles)
+void PPU::hdraw_end()
 {
-    for (int i = 0; i < cycles; i++)
+    if (m_mmio[REG_VCOUNT] >= FRAME_HEIGHT) return;
+
+    // a frame that is mode 3 vram as it is gets shown from vram, lines only get drawn once
+    // that stops being true. the frame buffer wasn't kept up to date until then so it takes
+    // the lines shown so far, or all of the last frame when that happens on the first line
+    bool is_direct = is_direct_line();
+    if (m_direct_frame && !is_direct)
     {
-        if (m_scanline_cycles == 1232)
-        {
-            m_mmio[REG_DISPSTAT] &= ~2; // hdraw has started
-            m_mmio[REG_VCOUNT] += 1;
-            m_scanline_cycles = 1;
+        int shown_lines = (m_mmio[REG_VCOUNT] == 0) ? FRAME_HEIGHT : m_mmio[REG_VCOUNT];
+        std::memcpy(m_frame.data(), m_vram.data(), shown_lines * sizeof(m_frame[0]));
+        m_direct_frame = false;
+    }
+    else if (m_mmio[REG_VCOUNT] == 0)
+    {
+        m_direct_frame = is_direct;
+    }
 
-            bool trigger_vcount_irq = ((m_mmio[REG_DISPSTAT] >> 5) & 1) && (((m_mmio[REG_DISPSTAT] >> 8) & 0xFF) == m_mmio[REG_VCOUNT]);
-            m_mmio[REG_DISPSTAT] |= trigger_vcount_irq << 2;
-            *m_if_reg |= trigger_vcount_irq << 2;
+    bool should_force_blank = (m_mmio[REG_DISPCNT] >> 7) & 1;
+    if (m_direct_frame)
+    {
+        // nothing to draw
+    }
+    else if (!should_force_blank)
+    {
+        // every layer draws into its own line buffer and the compositor picks the front pixels
+        m_line_layers = 0;
+        m_tile_cache.invalidate(m_vram_dirty);
+        switch (m_mmio[REG_DISPCNT] & 7) 
+        {
+        case 0:
+            draw_scanline_tilemap_0();
+            break;
+        case 1:
+            draw_scanline_tilemap_1();
+            break;
+        case 2:
+            draw_scanline_tilemap_2();
+            break;
+        case 3:
+            draw_scanline_bitmap_3();
+            break;
+        case 4:
+            draw_scanline_bitmap_4();
+            break;
+        case 5:
+            draw_scanline_bitmap_5();
+            break;
+        default: std::unreachable();
+        }
+        if ((m_mmio[REG_DISPCNT] >> 0xC) & 1)
+        {
+            render_sprites();
+        }
 
-            if (m_mmio[REG_VCOUNT] == 228)
-            {
-                m_mmio[REG_VCOUNT] = 0;
-                m_mmio[REG_DISPSTAT] &= ~1; // vblank has ended
-            }
-            else if (m_mmio[REG_VCOUNT] == 160)
+        std::array<const std::uint32_t*, LAYER_COUNT> layers;
+        int count = 0;
+        for (int layer = 0; layer < LAYER_COUNT; layer++)
+        {
+            if ((m_line_layers >> layer) & 1)
             {
-                m_mmio[REG_DISPSTAT] |= 1; // vblank has started
-                *m_if_reg |= (m_mmio[REG_DISPSTAT] >> 3) & 1;
+                layers[count++] = m_lines[layer].data();
             }
         }
-        else if (m_scanline_cycles == 1007)
+        std::uint32_t backdrop = line_pixel(BACKDROP_ORDER, *reinterpret_cast<std::uint16_t*>(m_pallete_ram.data()));
+        compose_line(layers.data(), count, backdrop, m_frame[m_mmio[REG_VCOUNT]].data());
+    }
+    else
+    {
+        for (int col = 0; col < FRAME_WIDTH; col++)
         {
-            m_mmio[REG_DISPSTAT] |= 2; // hblank has started
-            *m_if_reg |= ((m_mmio[REG_DISPSTAT] >> 4) & 1) << 1;
+            m_frame[m_mmio[REG_VCOUNT]][col] = 0x7FFF;
         }
-        else if ((m_scanline_cycles == 960) && (m_mmio[REG_VCOUNT] < FRAME_HEIGHT))
+    }
+
+    // the reference points move down a line by pb and pd whether or not the backgrounds are shown
+    for (int affine = 0; affine < 2; affine++)
+    {
+        auto regs = m_mmio.data() + REGS_AFFINE + (affine * AFFINE_REGS_SIZE);
+        m_affine_ref_x[affine] += static_cast<std::int16_t>(regs[1]);
+        m_affine_ref_y[affine] += static_cast<std::int16_t>(regs[3]);
+    }
+}
+
+void PPU::hblank_start()
+{
+    m_mmio[REG_DISPSTAT] |= 2; // hblank has started
+    if ((m_mmio[REG_DISPSTAT] >> 4) & 1)
+    {
+        m_interrupts.request(Interrupts::HBLANK);
+    }
+}
+
+void PPU::scanline_end()
+{
+    m_mmio[REG_DISPSTAT] &= ~2; // hdraw has started
+    m_mmio[REG_VCOUNT] += 1;
+
+    if (m_mmio[REG_VCOUNT] == 228)
+    {
+        m_mmio[REG_VCOUNT] = 0;
+        m_mmio[REG_DISPSTAT] &= ~1; // vblank has ended
+    }
+    else if (m_mmio[REG_VCOUNT] == 160)
+    {
+        m_mmio[REG_DISPSTAT] |= 1; // vblank has started
+        latch_reference_points();
+        if ((m_mmio[REG_DISPSTAT] >> 3) & 1)
         {
-            bool should_force_blank = (m_mmio[REG_DISPCNT] >> 7) & 1;
-            if (!should_force_blank)
-            {
-                render_backdrop();
-                switch (m_mmio[REG_DISPCNT] & 7) 
-                {
-                case 0:
-                    draw_scanline_tilemap_0();
-                    break;
-                case 1:
-                    draw_scanline_tilemap_1();
-                    break;
-                case 2:
-                    draw_scanline_tilemap_2();
-                    break;
-                case 3:
-                    draw_scanline_bitmap_3();
-                    break;
-                case 4:
-                    draw_scanline_bitmap_4();
-                    break;
-                case 5:
-                    draw_scanline_bitmap_5();
-                    break;
-                default: std::unreachable();
-                }
-            }
-            else
-            {
-                for (int col = 0; col < FRAME_WIDTH; col++)
-                {
-                    m_frame[m_mmio[REG_VCOUNT]][col] = 0x7FFF;
-                }
-            }
+            m_interrupts.request(Interrupts::VBLANK);
         }
-        m_scanline_cycles++;
+    }
+
+    // the match flag follows every line, the interrupt only fires when it is enabled
+    bool vcount_match = ((m_mmio[REG_DISPSTAT] >> 8) & 0xFF) == m_mmio[REG_VCOUNT];
+    m_mmio[REG_DISPSTAT] = (m_mmio[REG_DISPSTAT] & ~4) | (vcount_match << 2);
+    if (vcount_match && ((m_mmio[REG_DISPSTAT] >> 5) & 1))
+    {
+        m_interrupts.request(Interrupts::VCOUNT);
+    }
+}
+
+void PPU::register_io(Io& io)
+{
+    io.on_write(REG_DISPSTAT * 2, (REG_DISPSTAT * 2) + 2, [](void* context, std::uint32_t, std::uint16_t value, std::uint16_t mask) {
+        auto* ppu = static_cast<PPU*>(context);
+        mask &= ~7;
+        ppu->m_mmio[REG_DISPSTAT] = (ppu->m_mmio[REG_DISPSTAT] & ~mask) | (value & mask);
+    }, this);
+    io.on_write(REG_VCOUNT * 2, (REG_VCOUNT * 2) + 2, [](void*, std::uint32_t, std::uint16_t, std::uint16_t) {}, nullptr);
+    // writing a reference point also resets the internal one of that coordinate
+    for (int affine = 0; affine < 2; affine++)
+    {
+        std::uint32_t start = (REGS_AFFINE + (affine * AFFINE_REGS_SIZE) + 4) * 2;
+        io.on_write(start, start + 8, [](void* context, std::uint32_t offset, std::uint16_t value, std::uint16_t mask) {
+            auto* ppu = static_cast<PPU*>(context);
+            Io::store(reinterpret_cast<std::uint8_t*>(ppu->m_mmio.data()), offset, value, mask);
+            int affine = ((offset / 2) - REGS_AFFINE) / AFFINE_REGS_SIZE;
+            bool y = offset & 4;
+            (y ? ppu->m_affine_ref_y : ppu->m_affine_ref_x)[affine] = ppu->reference_point(affine, y);
+        }, this);
+    }
+}
+
+void PPU::handle_event(Scheduler::Event event, std::uint64_t timestamp)
+{
+    switch (event)
+    {
+    case Scheduler::Event::HDRAW_END:
+        hdraw_end();
+        break;
+    case Scheduler::Event::HBLANK_START:
+        hblank_start();
+        break;
+    case Scheduler::Event::SCANLINE_END:
+        scanline_end();
+        schedule_scanline(timestamp);
+        break;
+    default: std::unreachable();
     }
 }
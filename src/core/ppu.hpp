@@ -2,22 +2,61 @@
 #define PPU_HPP
 
 #include <array>
+#include <bitset>
 #include <vector>
 #include <span>
+#include <utility>
+
+#include "compositor.hpp"
+#include "interrupts.hpp"
+#include "io.hpp"
+#include "scheduler.hpp"
+#include "tile_cache.hpp"
 
 typedef std::array<std::array<std::uint16_t, 240>, 160> FrameBuffer;
 
 class PPU
 {
     public:
-        PPU(std::span<std::uint16_t, 42> mmio, uint8_t *if_reg) : m_mmio(mmio), m_if_reg(if_reg), m_scanline_cycles(1)
+        PPU(std::span<std::uint16_t, 42> mmio, Interrupts& interrupts, Scheduler& scheduler) : m_mmio(mmio), m_interrupts(interrupts), m_scheduler(scheduler)
         {
-            m_vram.resize(0x18000);
             m_oam.resize(0x400);
             m_pallete_ram.resize(0x400);
+            m_oam_dirty.set();
+            schedule_scanline(m_scheduler.now());
+        }
+
+        void handle_event(Scheduler::Event event, std::uint64_t timestamp);
+        //! the status bits of DISPSTAT and VCOUNT are read only
+        void register_io(Io& io);
+
+        //! the video memory a page of the bus maps, writes to it are tracked
+        enum class Region : std::uint8_t
+        {
+            NONE = 0, PALETTE, VRAM, OAM
+        };
+
+        //! marks what changed after size bytes were written at host, which lies in region
+        void written(Region region, const std::uint8_t* host, std::uint32_t size) noexcept
+        {
+            switch (region)
+            {
+            case Region::PALETTE: mark_dirty(m_palette_dirty, host - m_pallete_ram.data(), size, 1); break;
+            case Region::VRAM: mark_dirty(m_vram_dirty, host - m_vram.data(), size, 5); break;
+            case Region::OAM: mark_dirty(m_oam_dirty, host - m_oam.data(), size, 3); break;
+            default: break;
+            }
         }
 
-        void tick(int cycles);
+        //! colours written since the last call, for viewers and incremental save states
+        std::bitset<0x400 / 2> take_palette_changes() noexcept { return std::exchange(m_palette_dirty, {}); }
+
+        //! decoded tile for viewers, see TileCache::tile
+        const std::uint8_t* decoded_tile(std::uint32_t offset, bool is_256_color) noexcept
+        {
+            m_tile_cache.invalidate(m_vram_dirty);
+            return m_tile_cache.tile(m_vram, offset, is_256_color);
+        }
 
     public:
         enum MMIO
@@ -26,24 +65,89 @@ class PPU
             REG_DISPSTAT = 2,
             REG_VCOUNT = 3,
             REGS_BGCNT = 4, // base offset to group of bgxcnt regs
-            REGS_OFS = 8 // base offset to group of vofs/hofs regs
+            REGS_OFS = 8, // base offset to group of vofs/hofs regs
+            REGS_AFFINE = 16, // base offset to the pa-pd, x and y regs of bg2 then bg3
+            REG_BLDCNT = 40
         };
+        static constexpr int AFFINE_REGS_SIZE = 8;
+
+        //! the last frame drawn, in mode 3 without anything over bg2 that is vram itself. colours may have bit 15 set
+        FrameBuffer& frame() noexcept;
 
         FrameBuffer m_frame{{}};
-        std::vector<std::uint8_t> m_vram;
+        //! owned by Memory
+        std::span<std::uint8_t> m_vram;
         std::vector<std::uint8_t> m_oam;
         std::vector<std::uint8_t> m_pallete_ram;
         std::span<std::uint16_t, 42> m_mmio;
-        std::uint8_t *m_if_reg;
+        Interrupts& m_interrupts;
+
+        // a bit per 32 byte tile of vram, per colour of the palette and per object in oam,
+        // set by writes and cleared by whatever caches their contents
+        std::bitset<0x18000 / 32> m_vram_dirty;
+        std::bitset<0x400 / 2> m_palette_dirty;
+        std::bitset<0x400 / 8> m_oam_dirty;
 
     private:
+        template <std::size_t N>
+        static void mark_dirty(std::bitset<N>& dirty, std::uint32_t offset, std::uint32_t size, int shift) noexcept
+        {
+            for (std::uint32_t unit = offset >> shift; unit <= ((offset + size - 1) >> shift); unit++)
+            {
+                dirty[unit] = true;
+            }
+        }
+
+        //! line buffers of a scanline, objects come first so they stay in front of backgrounds of the same priority
+        enum Layer
+        {
+            LAYER_OBJ = 0, LAYER_BG0, LAYER_BG1, LAYER_BG2, LAYER_BG3, LAYER_COUNT
+        };
+        //! behind every layer of the lowest priority
+        static constexpr std::uint32_t BACKDROP_ORDER = 4 << 3;
+        //! what backgrounds see past their half of vram
+        static constexpr std::array<std::uint8_t, 8> EMPTY_TILE_ROW{};
+
         std::uint16_t get_tile_offset(int tx, int ty, bool bg_reg_64x64) const noexcept;
         std::uint16_t get_sprite_size(std::uint8_t shape) const noexcept;
-        std::array<std::uint16_t, 4> bg_priority_list() const noexcept;
+        //! draw order of a background's pixels, its priority and then its number
+        std::uint32_t bg_order(int bg) const noexcept;
 
-        void render_backdrop();
-        void render_text_bg(std::uint16_t bgcnt, std::uint16_t bghofs, std::uint16_t bgvofs);
-        void render_sprite(std::uint64_t sprite_entry, bool is_dim_1);
+        void render_text_bg(int bg);
+        void render_affine_bg(int bg);
+        //! map pixel of each column of the line into m_affine_x/y, x is -1 off a map that doesn't wrap
+        void step_affine_line(std::int32_t x, std::int32_t y, std::int32_t dx, std::int32_t dy, int size, bool wrap) noexcept;
+        //! BGxX/BGxY of bg2 (affine 0) or bg3
+        std::int32_t reference_point(int affine, bool y) const noexcept;
+        void latch_reference_points() noexcept;
+        //! an oam entry as the renderer needs it, decoded again when the entry is written
+        struct Object
+        {
+            bool visible = false;
+            bool affine = false;
+            bool is_256_color = false;
+            bool h_flip = false;
+            bool v_flip = false;
+            std::uint8_t mode = 0;
+            std::uint8_t priority = 0;
+            std::uint8_t pallete_bank = 0;
+            std::uint8_t affine_group = 0;
+            std::uint8_t y = 0;
+            std::int16_t x = 0;
+            std::uint16_t tile = 0;
+            std::uint8_t width = 0;
+            std::uint8_t height = 0;
+            //! the area drawn, twice the size of double size affine objects
+            std::uint8_t box_width = 0;
+            std::uint8_t box_height = 0;
+        };
+
+        void update_objects();
+        //! adds or removes an object from the lines it covers
+        void set_object_lines(int index, const Object& object, bool visible) noexcept;
+        std::uint8_t object_pixel(const Object& object, int x, int y, bool is_dim_1) noexcept;
+        void render_object(const Object& object, bool is_dim_1, LineBuffer& line);
+        void render_sprites();
 
         void draw_scanline_tilemap_0();
         void draw_scanline_tilemap_1();
@@ -51,9 +155,30 @@ class PPU
         void draw_scanline_bitmap_3();
         void draw_scanline_bitmap_4();
         void draw_scanline_bitmap_5();
+        //! the line would be drawn exactly as it is in vram
+        bool is_direct_line() const noexcept;
+
+        void schedule_scanline(std::uint64_t line_start);
+        void hdraw_end();
+        void hblank_start();
+        void scanline_end();
 
     private:
-        std::uint32_t m_scanline_cycles;
+        Scheduler& m_scheduler;
+        std::array<LineBuffer, LAYER_COUNT> m_lines;
+        //! layers drawn on the current scanline
+        std::uint8_t m_line_layers = 0;
+        //! every line of the frame so far is shown straight from vram
+        bool m_direct_frame = false;
+        TileCache m_tile_cache;
+        //! internal reference points of bg2 and bg3, latched in vblank and on writes then stepped every line
+        std::array<std::int32_t, 2> m_affine_ref_x{};
+        std::array<std::int32_t, 2> m_affine_ref_y{};
+        std::array<std::int32_t, LINE_WIDTH> m_affine_x;
+        std::array<std::int32_t, LINE_WIDTH> m_affine_y;
+        std::array<Object, 128> m_objects;
+        //! a bit per object on each visible line, in oam order
+        std::array<std::array<std::uint64_t, 2>, 160> m_object_lines{};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "save_writer.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+SaveWriter::SaveWriter(const std::string& filepath) : m_filepath(filepath), m_thread(&SaveWriter::run, this)
+{
+}
+
+SaveWriter::~SaveWriter()
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void SaveWriter::submit(const std::uint8_t* data, std::size_t size, std::size_t start, std::size_t end)
+{
+    {
+        std::lock_guard lock(m_mutex);
+        m_image.resize(size);
+        std::copy(data + start, data + end, m_image.begin() + start);
+        if (m_dirty_start == m_dirty_end)
+        {
+            m_dirty_start = start;
+            m_dirty_end = end;
+        }
+        else
+        {
+            m_dirty_start = std::min(m_dirty_start, start);
+            m_dirty_end = std::max(m_dirty_end, end);
+        }
+    }
+    m_wake.notify_one();
+}
+
+void SaveWriter::run()
+{
+    std::vector<std::uint8_t> pending;
+    std::unique_lock lock(m_mutex);
+    while (true)
+    {
+        m_wake.wait(lock, [this] { return m_stopping || (m_dirty_start != m_dirty_end); });
+        if (m_dirty_start == m_dirty_end) break;
+
+        // the file is written without the lock so submits never wait on the disk
+        std::size_t start = m_dirty_start;
+        pending.assign(m_image.begin() + m_dirty_start, m_image.begin() + m_dirty_end);
+        m_dirty_start = m_dirty_end = 0;
+        lock.unlock();
+        write_range(start, pending);
+        lock.lock();
+    }
+}
+
+void SaveWriter::write_range(std::size_t start, const std::vector<std::uint8_t>& data)
+{
+    FILE *fp = fopen(m_filepath.c_str(), "r+b");
+    if (fp == NULL)
+    {
+        fp = fopen(m_filepath.c_str(), "w+b");
+    }
+    if ((fp == NULL) || (fseek(fp, start, SEEK_SET) != 0) || (fwrite(data.data(), sizeof(std::uint8_t), data.size(), fp) != data.size()))
+    {
+        printf("failed to write %s\n", m_filepath.c_str());
+    }
+    if (fp != NULL)
+    {
+        fclose(fp);
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef SAVE_WRITER_HPP
+#define SAVE_WRITER_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes a battery file on a thread of its own. Submitted ranges are copied into an image of the
+// file and merged with whatever hasn't been written yet, so a burst of saves turns into one write.
+class SaveWriter
+{
+    public:
+        explicit SaveWriter(const std::string& filepath);
+        //! writes anything still pending before returning
+        ~SaveWriter();
+
+        SaveWriter(const SaveWriter&) = delete;
+        SaveWriter& operator=(const SaveWriter&) = delete;
+
+        //! queues [start, end) of a save of size bytes
+        void submit(const std::uint8_t* data, std::size_t size, std::size_t start, std::size_t end);
+
+    private:
+        void run();
+        void write_range(std::size_t start, const std::vector<std::uint8_t>& data);
+
+        std::string m_filepath;
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::vector<std::uint8_t> m_image;
+        //! range of m_image that hasn't reached the file, empty when start == end
+        std::size_t m_dirty_start = 0;
+        std::size_t m_dirty_end = 0;
+        bool m_stopping = false;
+        // started last so everything it touches is constructed
+        std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#include "scheduler.hpp"
+
+#include <algorithm>
+
+static bool later(const Scheduler::Entry& a, const Scheduler::Entry& b)
+{
+    return a.timestamp > b.timestamp;
+}
+
+void Scheduler::schedule(Event event, std::uint64_t timestamp)
+{
+    m_events.push_back({timestamp, event});
+    std::push_heap(m_events.begin(), m_events.end(), later);
+    m_next = m_events.front().timestamp;
+}
+
+void Scheduler::cancel(Event event)
+{
+    auto removed = std::remove_if(m_events.begin(), m_events.end(), [event](const Entry& entry) {
+        return entry.event == event;
+    });
+    if (removed == m_events.end()) return;
+
+    m_events.erase(removed, m_events.end());
+    std::make_heap(m_events.begin(), m_events.end(), later);
+    m_next = m_events.empty() ? NEVER : m_events.front().timestamp;
+}
+
+Scheduler::Entry Scheduler::pop()
+{
+    std::pop_heap(m_events.begin(), m_events.end(), later);
+    Entry entry = m_events.back();
+    m_events.pop_back();
+    m_next = m_events.empty() ? NEVER : m_events.front().timestamp;
+    return entry;
+}
@@ -0,0 +1,42 @@
+#ifndef SCHEDULER_HPP
+#define SCHEDULER_HPP
+
+#include <cstdint>
+#include <vector>
+
+class Scheduler
+{
+    public:
+        enum class Event : std::uint8_t
+        {
+            HDRAW_END = 0, HBLANK_START, SCANLINE_END, DMA,
+            TIMER0_OVERFLOW, TIMER1_OVERFLOW, TIMER2_OVERFLOW, TIMER3_OVERFLOW
+        };
+
+        struct Entry
+        {
+            std::uint64_t timestamp;
+            Event event;
+        };
+
+        Scheduler() : m_now(0), m_next(NEVER) {};
+
+        void schedule(Event event, std::uint64_t timestamp);
+        void cancel(Event event);
+        Entry pop();
+
+        void advance(int cycles) noexcept { m_now += cycles; }
+        bool pending() const noexcept { return m_now >= m_next; }
+        std::uint64_t now() const noexcept { return m_now; }
+        std::uint64_t next_timestamp() const noexcept { return m_next; }
+
+        static constexpr std::uint64_t NEVER = ~0ULL;
+
+    private:
+        // min-heap on timestamp, m_next caches the root so the hot path is a single compare
+        std::vector<Entry> m_events;
+        std::uint64_t m_now;
+        std::uint64_t m_next;
+};
+
+#endif
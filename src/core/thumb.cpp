@@ -1,5 +1,7 @@
 #include "cpu.hpp"
 
+#include <utility>
+
 std::uint32_t CPU::thumb_translate_1(std::uint16_t instr) 
 {
     std::uint32_t translation = 0b11100001101100000000000000000000;
@@ -46,6 +48,57 @@ std::uint32_t CPU::thumb_translate_3(std::uint16_t instr)
     return translation;
 }
 
+std::uint32_t CPU::thumb_translate_4(std::uint16_t instr) 
+{
+    std::uint32_t translation = 0b11100000000100000000000000000000;
+    std::uint32_t rd = instr & 0x7;
+    std::uint32_t rs = (instr >> 3) & 0x7;
+    std::uint32_t arm_opcode = (instr >> 6) & 0xF;
+    ShiftType shift_type = ShiftType::LSL;
+
+    translation |= (rd << 12);
+
+    switch ((instr >> 6) & 0xF) 
+    {
+    case 0x2:
+        goto thumb_shift_instr;
+    case 0x3:
+        shift_type = ShiftType::LSR;
+        goto thumb_shift_instr;
+    case 0x4:
+        shift_type = ShiftType::ASR;
+        goto thumb_shift_instr;
+    case 0x7:
+        shift_type = ShiftType::ROR;
+        goto thumb_shift_instr;
+    case 0x9:
+        translation |= (0x3 << 21);
+        translation |= (0x1 << 25);
+        translation |= (rs << 16);
+        return translation;
+    case 0xD:
+        translation |= (rd << 16);
+        translation |= rs;
+        translation |= (rd << 8);
+        return translation;
+    }
+
+    translation |= rs;
+
+    complete_translation:
+        translation |= (arm_opcode << 21);
+        translation |= (rd << 16);
+        translation |= (static_cast<std::uint32_t>(std::to_underlying(shift_type)) << 5);
+        return translation;
+
+    thumb_shift_instr:
+        arm_opcode = 0xD;
+        translation |= (0x1 << 4);
+        translation |= (rs << 8);
+        translation |= rd;
+        goto complete_translation;
+}
+
 std::uint32_t CPU::thumb_translate_5_alu(std::uint16_t instr) 
 {
     std::uint32_t translation = 0b11100000000000000000000000000000;
@@ -204,3 +257,609 @@ std::uint32_t CPU::thumb_translate_18(std::uint16_t instr)
     translation |= (offset & 0xFFFFFF);
     return translation;
 }
+
+template <std::uint8_t Cond>
+bool CPU::condition_passed() const
+{
+    if constexpr (Cond == 0x0) return flag_z();
+    else if constexpr (Cond == 0x1) return !flag_z();
+    else if constexpr (Cond == 0x2) return flag_c();
+    else if constexpr (Cond == 0x3) return !flag_c();
+    else if constexpr (Cond == 0x4) return flag_n();
+    else if constexpr (Cond == 0x5) return !flag_n();
+    else if constexpr (Cond == 0x6) return flag_v();
+    else if constexpr (Cond == 0x7) return !flag_v();
+    else if constexpr (Cond == 0x8) return flag_c() && !flag_z();
+    else if constexpr (Cond == 0x9) return !flag_c() || flag_z();
+    else if constexpr (Cond == 0xA) return flag_n() == flag_v();
+    else if constexpr (Cond == 0xB) return flag_n() != flag_v();
+    else if constexpr (Cond == 0xC) return !flag_z() && (flag_n() == flag_v());
+    else if constexpr (Cond == 0xD) return flag_z() || (flag_n() != flag_v());
+    else return true;
+}
+
+// register specified shifts keyed on the format 4 opcode, amounts past 31 follow the ARM7TDMI rules
+template <std::uint8_t Opcode>
+static std::uint32_t shift_by_register(std::uint32_t operand, std::uint8_t shift_amount, bool& carry)
+{
+    if (shift_amount == 0) return operand;
+
+    if constexpr (Opcode == 0x2) // LSL
+    {
+        if (shift_amount < 32)
+        {
+            carry = (operand >> (32 - shift_amount)) & 1;
+            return operand << shift_amount;
+        }
+        carry = (shift_amount == 32) && (operand & 1);
+        return 0;
+    }
+    else if constexpr (Opcode == 0x3) // LSR
+    {
+        if (shift_amount < 32)
+        {
+            carry = (operand >> (shift_amount - 1)) & 1;
+            return operand >> shift_amount;
+        }
+        carry = (shift_amount == 32) && (operand >> 31);
+        return 0;
+    }
+    else if constexpr (Opcode == 0x4) // ASR
+    {
+        if (shift_amount < 32)
+        {
+            carry = (operand >> (shift_amount - 1)) & 1;
+            return static_cast<std::int32_t>(operand) >> shift_amount;
+        }
+        carry = operand >> 31;
+        return static_cast<std::int32_t>(operand) >> 31;
+    }
+    else // ROR
+    {
+        std::uint32_t result = (operand >> (shift_amount & 31)) | (operand << ((-shift_amount) & 31));
+        carry = result >> 31;
+        return result;
+    }
+}
+
+template <CPU::ShiftType Shift>
+int CPU::thumb_move_shifted(std::uint32_t instr)
+{
+    auto& regs = m_regs;
+    std::uint8_t shift_amount = (instr >> 6) & 0x1F;
+    std::uint32_t operand = regs[(instr >> 3) & 0x7];
+    std::uint32_t result = operand;
+    bool carry = false;
+
+    if constexpr (Shift == ShiftType::LSL)
+    {
+        carry = flag_c();
+        if (shift_amount)
+        {
+            carry = (operand >> (32 - shift_amount)) & 1;
+            result = operand << shift_amount;
+        }
+    }
+    else if constexpr (Shift == ShiftType::LSR)
+    {
+        // an encoded shift of 0 stands for 32
+        carry = (operand >> ((shift_amount - 1) & 31)) & 1;
+        result = shift_amount ? (operand >> shift_amount) : 0;
+    }
+    else
+    {
+        carry = (operand >> ((shift_amount - 1) & 31)) & 1;
+        result = static_cast<std::int32_t>(operand) >> (shift_amount ? shift_amount : 31);
+    }
+
+    set_logical_flags(result, carry);
+    regs[instr & 0x7] = result;
+    return 1;
+}
+
+template <bool Imm, bool Sub>
+int CPU::thumb_add_subtract(std::uint32_t instr)
+{
+    auto& regs = m_regs;
+    std::uint32_t op1 = regs[(instr >> 3) & 0x7];
+    std::uint32_t op2 = Imm ? ((instr >> 6) & 0x7) : regs[(instr >> 6) & 0x7];
+    regs[instr & 0x7] = Sub ? sub_with_flags(op1, op2, true) : add_with_flags(op1, op2, false);
+    return 1;
+}
+
+template <std::uint8_t Opcode>
+int CPU::thumb_immediate_op(std::uint32_t instr)
+{
+    auto& regs = m_regs;
+    std::uint8_t rd = (instr >> 8) & 0x7;
+    std::uint32_t nn = instr & 0xFF;
+
+    if constexpr (Opcode == 0x0) // MOV
+    {
+        set_logical_flags(nn, flag_c());
+        regs[rd] = nn;
+    }
+    else if constexpr (Opcode == 0x1) // CMP
+    {
+        sub_with_flags(regs[rd], nn, true);
+    }
+    else if constexpr (Opcode == 0x2) // ADD
+    {
+        regs[rd] = add_with_flags(regs[rd], nn, false);
+    }
+    else // SUB
+    {
+        regs[rd] = sub_with_flags(regs[rd], nn, true);
+    }
+    return 1;
+}
+
+template <std::uint8_t Opcode>
+int CPU::thumb_alu_op(std::uint32_t instr)
+{
+    auto& regs = m_regs;
+    std::uint8_t rd = instr & 0x7;
+    std::uint32_t op1 = regs[rd];
+    std::uint32_t op2 = regs[(instr >> 3) & 0x7];
+    std::uint32_t result = 0;
+    bool carry = flag_c();
+
+    if constexpr (Opcode == 0x0) result = op1 & op2; // AND
+    else if constexpr (Opcode == 0x1) result = op1 ^ op2; // EOR
+    else if constexpr (Opcode == 0x2) result = shift_by_register<0x2>(op1, op2 & 0xFF, carry);
+    else if constexpr (Opcode == 0x3) result = shift_by_register<0x3>(op1, op2 & 0xFF, carry);
+    else if constexpr (Opcode == 0x4) result = shift_by_register<0x4>(op1, op2 & 0xFF, carry);
+    else if constexpr (Opcode == 0x5) result = add_with_flags(op1, op2, carry); // ADC
+    else if constexpr (Opcode == 0x6) result = sub_with_flags(op1, op2, carry); // SBC
+    else if constexpr (Opcode == 0x7) result = shift_by_register<0x7>(op1, op2 & 0xFF, carry);
+    else if constexpr (Opcode == 0x8) result = op1 & op2; // TST
+    else if constexpr (Opcode == 0x9) result = sub_with_flags(0, op2, true); // NEG
+    else if constexpr (Opcode == 0xA) result = sub_with_flags(op1, op2, true); // CMP
+    else if constexpr (Opcode == 0xB) result = add_with_flags(op1, op2, false); // CMN
+    else if constexpr (Opcode == 0xC) result = op1 | op2; // ORR
+    else if constexpr (Opcode == 0xD) result = op1 * op2; // MUL
+    else if constexpr (Opcode == 0xE) result = op1 & ~op2; // BIC
+    else result = ~op2; // MVN
+
+    // the arithmetic ops already set all four flags, the rest only update N and Z
+    if constexpr ((Opcode != 0x5) && (Opcode != 0x6) && ((Opcode < 0x9) || (Opcode > 0xB)))
+    {
+        set_logical_flags(result, carry);
+    }
+    if constexpr ((Opcode != 0x8) && (Opcode != 0xA) && (Opcode != 0xB))
+    {
+        regs[rd] = result;
+    }
+
+    if constexpr ((Opcode == 0x2) || (Opcode == 0x3) || (Opcode == 0x4) || (Opcode == 0x7))
+    {
+        internal_cycles(1);
+    }
+    else if constexpr (Opcode == 0xD)
+    {
+        internal_cycles(multiply_cycles(op1, true));
+    }
+    return 1;
+}
+
+template <std::uint8_t Opcode>
+int CPU::thumb_hi_reg_op(std::uint32_t instr)
+{
+    auto& regs = m_regs;
+    std::uint8_t rd = (((instr >> 7) & 1) << 3) | (instr & 0x7);
+    std::uint32_t operand = regs[(((instr >> 6) & 1) << 3) | ((instr >> 3) & 0x7)];
+
+    if constexpr (Opcode == 0x0) // ADD
+    {
+        safe_reg_assign(rd, regs[rd] + operand);
+    }
+    else if constexpr (Opcode == 0x1) // CMP
+    {
+        sub_with_flags(regs[rd], operand, true);
+    }
+    else // MOV
+    {
+        safe_reg_assign(rd, operand);
+    }
+    return 1;
+}
+
+int CPU::thumb_branch_ex(std::uint32_t instr)
+{
+    std::uint32_t target = m_regs[(((instr >> 6) & 1) << 3) | ((instr >> 3) & 0x7)];
+    update_cpsr_thumb_status(target & 1);
+    m_regs[15] = target & ~(0b1 | (!(target & 1) * 0b10));
+    m_pipeline_invalid = true;
+    return 1;
+}
+
+int CPU::thumb_load_pc_relative(std::uint32_t instr)
+{
+    internal_cycles(1);
+    std::uint8_t rd = (instr >> 8) & 0x7;
+    std::uint16_t nn = (instr & 0xFF) << 2;
+    m_regs[rd] = bus_read<std::uint32_t>((m_regs[15] & ~2) + nn);
+    return 1;
+}
+
+template <bool Load, bool Byte>
+int CPU::thumb_transfer_reg_offset(std::uint32_t instr)
+{
+    if constexpr (Load) internal_cycles(1);
+    auto& regs = m_regs;
+    std::uint8_t rd = instr & 0x7;
+    std::uint32_t addr = regs[(instr >> 3) & 0x7] + regs[(instr >> 6) & 0x7];
+
+    if constexpr (Load)
+    {
+        regs[rd] = Byte ? bus_read<std::uint8_t>(addr) : ror(bus_read<std::uint32_t>(addr), (addr & 0x3) * 8);
+    }
+    else if constexpr (Byte)
+    {
+        bus_write<std::uint8_t>(addr, regs[rd]);
+    }
+    else
+    {
+        bus_write<std::uint32_t>(addr, regs[rd]);
+    }
+    return 1;
+}
+
+template <std::uint8_t Opcode>
+int CPU::thumb_transfer_sign_extended(std::uint32_t instr)
+{
+    if constexpr (Opcode != 0x0) internal_cycles(1);
+    auto& regs = m_regs;
+    std::uint8_t rd = instr & 0x7;
+    std::uint32_t addr = regs[(instr >> 3) & 0x7] + regs[(instr >> 6) & 0x7];
+
+    if constexpr (Opcode == 0x0) // STRH
+    {
+        bus_write<std::uint16_t>(addr, regs[rd]);
+    }
+    else if constexpr (Opcode == 0x1) // LDSB
+    {
+        regs[rd] = static_cast<std::int32_t>(static_cast<std::int8_t>(bus_read<std::uint8_t>(addr)));
+    }
+    else if constexpr (Opcode == 0x2) // LDRH
+    {
+        regs[rd] = (addr & 1) ? ror(bus_read<std::uint16_t>(addr - 1), 8) : bus_read<std::uint16_t>(addr);
+    }
+    else // LDSH, a misaligned address loads a sign extended byte
+    {
+        regs[rd] = (addr & 1) ? static_cast<std::int32_t>(static_cast<std::int8_t>(bus_read<std::uint8_t>(addr)))
+            : static_cast<std::int32_t>(static_cast<std::int16_t>(bus_read<std::uint16_t>(addr)));
+    }
+    return 1;
+}
+
+template <bool Load, bool Byte>
+int CPU::thumb_transfer_imm_offset(std::uint32_t instr)
+{
+    if constexpr (Load) internal_cycles(1);
+    auto& regs = m_regs;
+    std::uint8_t rd = instr & 0x7;
+    std::uint32_t addr = regs[(instr >> 3) & 0x7] + (((instr >> 6) & 0x1F) << (Byte ? 0 : 2));
+
+    if constexpr (Load)
+    {
+        regs[rd] = Byte ? bus_read<std::uint8_t>(addr) : ror(bus_read<std::uint32_t>(addr), (addr & 0x3) * 8);
+    }
+    else if constexpr (Byte)
+    {
+        bus_write<std::uint8_t>(addr, regs[rd]);
+    }
+    else
+    {
+        bus_write<std::uint32_t>(addr, regs[rd]);
+    }
+    return 1;
+}
+
+template <bool Load>
+int CPU::thumb_transfer_halfword(std::uint32_t instr)
+{
+    if constexpr (Load) internal_cycles(1);
+    auto& regs = m_regs;
+    std::uint8_t rd = instr & 0x7;
+    std::uint32_t addr = regs[(instr >> 3) & 0x7] + (((instr >> 6) & 0x1F) << 1);
+
+    if constexpr (Load)
+    {
+        regs[rd] = (addr & 1) ? ror(bus_read<std::uint16_t>(addr - 1), 8) : bus_read<std::uint16_t>(addr);
+    }
+    else
+    {
+        bus_write<std::uint16_t>(addr, regs[rd]);
+    }
+    return 1;
+}
+
+template <bool Load>
+int CPU::thumb_transfer_sp_relative(std::uint32_t instr)
+{
+    if constexpr (Load) internal_cycles(1);
+    auto& regs = m_regs;
+    std::uint8_t rd = (instr >> 8) & 0x7;
+    std::uint32_t addr = regs[13] + ((instr & 0xFF) << 2);
+
+    if constexpr (Load)
+    {
+        regs[rd] = ror(bus_read<std::uint32_t>(addr), (addr & 0x3) * 8);
+    }
+    else
+    {
+        bus_write<std::uint32_t>(addr, regs[rd]);
+    }
+    return 1;
+}
+
+template <bool Sp>
+int CPU::thumb_load_address(std::uint32_t instr)
+{
+    auto& regs = m_regs;
+    std::uint32_t nn = (instr & 0xFF) << 2;
+    regs[(instr >> 8) & 0x7] = (Sp ? regs[13] : (regs[15] & ~2)) + nn;
+    return 1;
+}
+
+int CPU::thumb_adjust_sp(std::uint32_t instr)
+{
+    std::uint32_t nn = (instr & 0x7F) << 2;
+    m_regs[13] += ((instr >> 7) & 1) ? -nn : nn;
+    return 1;
+}
+
+template <bool Pop, bool PcLr>
+int CPU::thumb_push_pop(std::uint32_t instr)
+{
+    if constexpr (Pop) internal_cycles(1);
+    auto& regs = m_regs;
+    std::uint8_t reg_list = instr & 0xFF;
+    std::uint32_t addr = regs[13];
+
+    if (!PcLr && !reg_list) [[unlikely]]
+    {
+        // empty lists transfer r15 and move the stack pointer by 16 words
+        if constexpr (Pop)
+        {
+            regs[15] = bus_read<std::uint32_t>(addr);
+            m_pipeline_invalid = true;
+            regs[13] += 0x40;
+        }
+        else
+        {
+            regs[13] -= 0x40;
+            bus_write<std::uint32_t>(regs[13], regs[15] + 2);
+        }
+        return 1;
+    }
+
+    if constexpr (Pop)
+    {
+        regs[13] += (__builtin_popcount(reg_list) + PcLr) * 4;
+        for (int reg = 0; reg < 8; reg++)
+        {
+            if ((reg_list >> reg) & 1)
+            {
+                regs[reg] = bus_read<std::uint32_t>(addr);
+                addr += 4;
+            }
+        }
+        if constexpr (PcLr)
+        {
+            regs[15] = bus_read<std::uint32_t>(addr) & ~1;
+            m_pipeline_invalid = true;
+        }
+    }
+    else
+    {
+        addr -= (__builtin_popcount(reg_list) + PcLr) * 4;
+        regs[13] = addr;
+        for (int reg = 0; reg < 8; reg++)
+        {
+            if ((reg_list >> reg) & 1)
+            {
+                bus_write<std::uint32_t>(addr, regs[reg]);
+                addr += 4;
+            }
+        }
+        if constexpr (PcLr)
+        {
+            bus_write<std::uint32_t>(addr, regs[14]);
+        }
+    }
+    return 1;
+}
+
+template <bool Load>
+int CPU::thumb_multiple_transfer(std::uint32_t instr)
+{
+    if constexpr (Load) internal_cycles(1);
+    auto& regs = m_regs;
+    std::uint8_t rb = (instr >> 8) & 0x7;
+    std::uint8_t reg_list = instr & 0xFF;
+    std::uint32_t addr = regs[rb];
+
+    if (!reg_list) [[unlikely]]
+    {
+        if constexpr (Load)
+        {
+            regs[15] = bus_read<std::uint32_t>(addr);
+            m_pipeline_invalid = true;
+        }
+        else
+        {
+            bus_write<std::uint32_t>(addr, regs[15] + 2);
+        }
+        regs[rb] += 0x40;
+        return 1;
+    }
+
+    // the base is written back before the transfers, a loaded base wins over the writeback and
+    // a stored base is only the original value when it is the first register in the list
+    regs[rb] += __builtin_popcount(reg_list) * 4;
+    int first_transfer = __builtin_ctz(reg_list);
+    for (int reg = first_transfer; reg < 8; reg++)
+    {
+        if ((reg_list >> reg) & 1)
+        {
+            if constexpr (Load)
+            {
+                regs[reg] = bus_read<std::uint32_t>(addr);
+            }
+            else
+            {
+                bus_write<std::uint32_t>(addr, ((reg == rb) && (reg == first_transfer)) ? addr : regs[reg]);
+            }
+            addr += 4;
+        }
+    }
+    return 1;
+}
+
+template <std::uint8_t Cond>
+int CPU::thumb_cond_branch(std::uint32_t instr)
+{
+    if (condition_passed<Cond>()) 
+    {
+        m_regs[15] += static_cast<std::int32_t>(static_cast<std::int8_t>(instr & 0xFF)) * 2;
+        m_pipeline_invalid = true;
+    }
+    return 1;
+}
+
+int CPU::thumb_branch(std::uint32_t instr)
+{
+    m_regs[15] += (static_cast<std::int32_t>((instr & 0x7FF) << 21) >> 21) * 2;
+    m_pipeline_invalid = true;
+    return 1;
+}
+
+int CPU::thumb_long_branch_prefix(std::uint32_t instr)
+{
+    std::uint32_t upper_half_offset = static_cast<std::int32_t>((instr & 0x7FF) << 21) >> 21;
+    m_regs[14] = m_regs[15] + (upper_half_offset << 12);
+    return 1;
+}
+
+int CPU::thumb_long_branch_suffix(std::uint32_t instr)
+{
+    std::uint32_t lower_half_offset = instr & 0x7FF;
+    std::uint32_t curr_pc = m_regs[15];
+    m_regs[15] = m_regs[14] + (lower_half_offset << 1);
+    m_regs[14] = (curr_pc - 2) | 1;
+    m_pipeline_invalid = true;
+    return 1;
+}
+
+bool CPU::translate_thumb_alu(std::uint16_t instr, std::uint32_t& translation)
+{
+    switch (m_thumb_lut[instr >> 6])
+    {
+    case InstrFormat::THUMB_1: translation = thumb_translate_1(instr); return true;
+    case InstrFormat::THUMB_2: translation = thumb_translate_2(instr); return true;
+    case InstrFormat::THUMB_3: translation = thumb_translate_3(instr); return true;
+    case InstrFormat::THUMB_4: translation = thumb_translate_4(instr); return ((instr >> 6) & 0xF) != 0xD;
+    case InstrFormat::THUMB_5_ALU: translation = thumb_translate_5_alu(instr); return true;
+    case InstrFormat::THUMB_13: translation = thumb_translate_13(instr); return true;
+    default: return false;
+    }
+}
+
+DecodedInstr CPU::decode_thumb(std::uint16_t instr, bool& ends_block)
+{
+    static constexpr std::array<Handler, 3> move_shifted = {
+        &CPU::thumb_move_shifted<ShiftType::LSL>, &CPU::thumb_move_shifted<ShiftType::LSR>, 
+        &CPU::thumb_move_shifted<ShiftType::ASR>
+    };
+    static constexpr std::array<Handler, 4> add_subtract = {
+        &CPU::thumb_add_subtract<false, false>, &CPU::thumb_add_subtract<false, true>, 
+        &CPU::thumb_add_subtract<true, false>, &CPU::thumb_add_subtract<true, true>
+    };
+    static constexpr std::array<Handler, 4> immediate_ops = {
+        &CPU::thumb_immediate_op<0x0>, &CPU::thumb_immediate_op<0x1>, 
+        &CPU::thumb_immediate_op<0x2>, &CPU::thumb_immediate_op<0x3>
+    };
+    static constexpr std::array<Handler, 16> alu_ops = {
+        &CPU::thumb_alu_op<0x0>, &CPU::thumb_alu_op<0x1>, &CPU::thumb_alu_op<0x2>, &CPU::thumb_alu_op<0x3>,
+        &CPU::thumb_alu_op<0x4>, &CPU::thumb_alu_op<0x5>, &CPU::thumb_alu_op<0x6>, &CPU::thumb_alu_op<0x7>,
+        &CPU::thumb_alu_op<0x8>, &CPU::thumb_alu_op<0x9>, &CPU::thumb_alu_op<0xA>, &CPU::thumb_alu_op<0xB>,
+        &CPU::thumb_alu_op<0xC>, &CPU::thumb_alu_op<0xD>, &CPU::thumb_alu_op<0xE>, &CPU::thumb_alu_op<0xF>
+    };
+    static constexpr std::array<Handler, 3> hi_reg_ops = {
+        &CPU::thumb_hi_reg_op<0x0>, &CPU::thumb_hi_reg_op<0x1>, &CPU::thumb_hi_reg_op<0x2>
+    };
+    static constexpr std::array<Handler, 4> reg_offset_transfers = {
+        &CPU::thumb_transfer_reg_offset<false, false>, &CPU::thumb_transfer_reg_offset<false, true>, 
+        &CPU::thumb_transfer_reg_offset<true, false>, &CPU::thumb_transfer_reg_offset<true, true>
+    };
+    static constexpr std::array<Handler, 4> sign_extended_transfers = {
+        &CPU::thumb_transfer_sign_extended<0x0>, &CPU::thumb_transfer_sign_extended<0x1>, 
+        &CPU::thumb_transfer_sign_extended<0x2>, &CPU::thumb_transfer_sign_extended<0x3>
+    };
+    static constexpr std::array<Handler, 4> imm_offset_transfers = {
+        &CPU::thumb_transfer_imm_offset<false, false>, &CPU::thumb_transfer_imm_offset<true, false>, 
+        &CPU::thumb_transfer_imm_offset<false, true>, &CPU::thumb_transfer_imm_offset<true, true>
+    };
+    static constexpr std::array<Handler, 4> push_pop = {
+        &CPU::thumb_push_pop<false, false>, &CPU::thumb_push_pop<false, true>, 
+        &CPU::thumb_push_pop<true, false>, &CPU::thumb_push_pop<true, true>
+    };
+    static constexpr std::array<Handler, 15> cond_branches = {
+        &CPU::thumb_cond_branch<0x0>, &CPU::thumb_cond_branch<0x1>, &CPU::thumb_cond_branch<0x2>, 
+        &CPU::thumb_cond_branch<0x3>, &CPU::thumb_cond_branch<0x4>, &CPU::thumb_cond_branch<0x5>, 
+        &CPU::thumb_cond_branch<0x6>, &CPU::thumb_cond_branch<0x7>, &CPU::thumb_cond_branch<0x8>, 
+        &CPU::thumb_cond_branch<0x9>, &CPU::thumb_cond_branch<0xA>, &CPU::thumb_cond_branch<0xB>, 
+        &CPU::thumb_cond_branch<0xC>, &CPU::thumb_cond_branch<0xD>, &CPU::thumb_cond_branch<0xE>
+    };
+
+    ends_block = false;
+    switch (m_thumb_lut[instr >> 6]) 
+    {
+    case InstrFormat::THUMB_1: return {move_shifted[(instr >> 11) & 0x3], instr};
+    case InstrFormat::THUMB_2: return {add_subtract[(instr >> 9) & 0x3], instr};
+    case InstrFormat::THUMB_3: return {immediate_ops[(instr >> 11) & 0x3], instr};
+    case InstrFormat::THUMB_4: return {alu_ops[(instr >> 6) & 0xF], instr};
+    case InstrFormat::THUMB_5_ALU: 
+        ends_block = ((instr >> 7) & 1) && ((instr & 0x7) == 0x7);
+        return {hi_reg_ops[(instr >> 8) & 0x3], instr};
+    case InstrFormat::THUMB_5_BX: 
+        ends_block = true;
+        return {&CPU::thumb_branch_ex, instr};
+    case InstrFormat::THUMB_6: return {&CPU::thumb_load_pc_relative, instr};
+    case InstrFormat::THUMB_7: return {reg_offset_transfers[(instr >> 10) & 0x3], instr};
+    case InstrFormat::THUMB_8: return {sign_extended_transfers[(instr >> 10) & 0x3], instr};
+    case InstrFormat::THUMB_9: return {imm_offset_transfers[(instr >> 11) & 0x3], instr};
+    case InstrFormat::THUMB_10: 
+        return {((instr >> 11) & 1) ? &CPU::thumb_transfer_halfword<true> : &CPU::thumb_transfer_halfword<false>, instr};
+    case InstrFormat::THUMB_11: 
+        return {((instr >> 11) & 1) ? &CPU::thumb_transfer_sp_relative<true> : &CPU::thumb_transfer_sp_relative<false>, instr};
+    case InstrFormat::THUMB_12: 
+        return {((instr >> 11) & 1) ? &CPU::thumb_load_address<true> : &CPU::thumb_load_address<false>, instr};
+    case InstrFormat::THUMB_13: return {&CPU::thumb_adjust_sp, instr};
+    case InstrFormat::THUMB_14: 
+        // pop with pc in the list, or with an empty one which loads r15
+        ends_block = ((instr >> 11) & 1) && (((instr >> 8) & 1) || !(instr & 0xFF));
+        return {push_pop[((instr >> 10) & 0x2) | ((instr >> 8) & 1)], instr};
+    case InstrFormat::THUMB_15: 
+        // an empty list loads r15
+        ends_block = ((instr >> 11) & 1) && !(instr & 0xFF);
+        return {((instr >> 11) & 1) ? &CPU::thumb_multiple_transfer<true> : &CPU::thumb_multiple_transfer<false>, instr};
+    case InstrFormat::THUMB_16: 
+        ends_block = true;
+        return {cond_branches[(instr >> 8) & 0xF], instr};
+    case InstrFormat::THUMB_17: 
+        ends_block = true;
+        return {&CPU::swi, instr};
+    case InstrFormat::THUMB_18: 
+        ends_block = true;
+        return {&CPU::thumb_branch, instr};
+    case InstrFormat::THUMB_19_PREFIX: return {&CPU::thumb_long_branch_prefix, instr};
+    case InstrFormat::THUMB_19_SUFFIX: 
+        ends_block = true;
+        return {&CPU::thumb_long_branch_suffix, instr};
+    case InstrFormat::NOP: return {&CPU::nop, instr};
+    default: std::unreachable();
+    }
+}
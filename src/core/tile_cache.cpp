@@ -0,0 +1,21 @@
+#include "tile_cache.hpp"
+
+void TileCache::decode(std::span<const std::uint8_t> vram, std::uint32_t index, bool is_256_color, DecodedTile& decoded) noexcept
+{
+    std::uint32_t offset = index * TILE_BYTES;
+    if (is_256_color)
+    {
+        for (std::uint32_t px = 0; px < 64; px++)
+        {
+            decoded[px] = vram[(offset + px) % VRAM_SIZE];
+        }
+        return;
+    }
+
+    for (std::uint32_t byte = 0; byte < TILE_BYTES; byte++)
+    {
+        std::uint8_t pair = vram[offset + byte];
+        decoded[byte * 2] = pair & 0x0F;
+        decoded[(byte * 2) + 1] = pair >> 4;
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef TILE_CACHE_HPP
+#define TILE_CACHE_HPP
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Tiles of vram decoded to one palette index per byte, 64 bytes a tile in rows of 8. Decoding is
+// done on first use and a tile stays decoded until the vram bytes behind it are written, so
+// backgrounds and objects that don't change aren't unpacked again every scanline.
+class TileCache
+{
+    public:
+        static constexpr std::uint32_t VRAM_SIZE = 0x18000;
+        static constexpr std::uint32_t TILE_BYTES = 32;
+        static constexpr std::uint32_t TILES = VRAM_SIZE / TILE_BYTES;
+
+        TileCache() : m_decoded(TILES * 2) {}
+
+        //! the tile whose data starts at offset, a multiple of 32. 256 colour tiles take the next 32 bytes too
+        const std::uint8_t* tile(std::span<const std::uint8_t> vram, std::uint32_t offset, bool is_256_color) noexcept
+        {
+            std::uint32_t index = (offset / TILE_BYTES) % TILES;
+            auto& valid = m_valid[is_256_color];
+            auto& decoded = m_decoded[(is_256_color * TILES) + index];
+            if (!valid[index]) [[unlikely]]
+            {
+                decode(vram, index, is_256_color, decoded);
+                valid[index] = true;
+            }
+            return decoded.data();
+        }
+
+        //! drops the tiles that overlap the written 32 byte units of vram, and clears them
+        void invalidate(std::bitset<TILES>& vram_dirty) noexcept
+        {
+            if (vram_dirty.none()) return;
+            m_valid[0] &= ~vram_dirty;
+            // a 256 colour tile also goes stale when the unit after its first one is written
+            m_valid[1] &= ~(vram_dirty | (vram_dirty >> 1));
+            vram_dirty.reset();
+        }
+
+    private:
+        using DecodedTile = std::array<std::uint8_t, 64>;
+
+        static void decode(std::span<const std::uint8_t> vram, std::uint32_t index, bool is_256_color, DecodedTile& decoded) noexcept;
+
+        //! 16 colour tiles first then 256 colour ones
+        std::vector<DecodedTile> m_decoded;
+        std::array<std::bitset<TILES>, 2> m_valid;
+};
+
+#endif
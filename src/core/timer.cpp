@@ -1 +1,89 @@
-#include "timer.hpp"
\ No newline at end of file
+#include "timer.hpp"
+
+void Timer::register_io(Io& io)
+{
+    for (int channel = 0; channel < 4; channel++)
+    {
+        io.on_read(REGS_BASE + (channel * REGS_SIZE), REGS_BASE + (channel * REGS_SIZE) + 2, [](void* context, std::uint32_t offset) {
+            auto* timer = static_cast<Timer*>(context);
+            return timer->counter((offset - REGS_BASE) / REGS_SIZE, timer->m_scheduler.now());
+        }, this);
+    }
+    io.on_write(REGS_BASE, REGS_BASE + (4 * REGS_SIZE), [](void* context, std::uint32_t offset, std::uint16_t value, std::uint16_t mask) {
+        static_cast<Timer*>(context)->write(offset, value, mask);
+    }, this);
+}
+
+void Timer::write(std::uint32_t offset, std::uint16_t value, std::uint16_t mask)
+{
+    int channel = (offset - REGS_BASE) / REGS_SIZE;
+    Channel& state = m_channels[channel];
+    if ((offset & 2) == 0)
+    {
+        // a new reload value only takes effect on the next overflow
+        state.reload = (state.reload & ~mask) | (value & mask);
+        return;
+    }
+
+    // latch the counter so it carries on from its current value with the new settings
+    std::uint64_t now = m_scheduler.now();
+    bool was_enabled = state.control & ENABLE;
+    state.counter = counter(channel, now);
+    state.start = now;
+    state.control = ((state.control & ~mask) | (value & mask)) & WRITABLE;
+    if (!was_enabled && (state.control & ENABLE))
+    {
+        state.counter = state.reload;
+    }
+    *reinterpret_cast<std::uint16_t*>(m_mmio + offset) = state.control;
+
+    m_scheduler.cancel(overflow_event(channel));
+    if (running(channel))
+    {
+        schedule_overflow(channel);
+    }
+}
+
+void Timer::overflow(int channel, std::uint64_t timestamp)
+{
+    for (; channel < 4; channel++)
+    {
+        Channel& state = m_channels[channel];
+        state.counter = state.reload;
+        state.start = timestamp;
+        if (state.control & IRQ)
+        {
+            m_interrupts.request(Interrupts::TIMER0 << channel);
+        }
+        if (running(channel))
+        {
+            schedule_overflow(channel);
+        }
+
+        // a cascaded timer counts the overflow and carries on down the chain if it overflows too
+        if ((channel == 3) || !(m_channels[channel + 1].control & ENABLE) || !cascaded(channel + 1)) break;
+        if (++m_channels[channel + 1].counter != 0) break;
+    }
+}
+
+std::uint16_t Timer::counter(int channel, std::uint64_t now) const noexcept
+{
+    const Channel& state = m_channels[channel];
+    if (!running(channel)) return state.counter;
+
+    std::uint64_t ticks = (now - state.start) >> PRESCALER_SHIFTS[state.control & PRESCALER];
+    std::uint64_t until_overflow = 0x10000 - state.counter;
+    if (ticks < until_overflow)
+    {
+        return static_cast<std::uint16_t>(state.counter + ticks);
+    }
+    // the overflow is due but its event hasn't been dispatched yet
+    return static_cast<std::uint16_t>(state.reload + ((ticks - until_overflow) % (0x10000 - state.reload)));
+}
+
+void Timer::schedule_overflow(int channel)
+{
+    const Channel& state = m_channels[channel];
+    std::uint64_t ticks = 0x10000 - state.counter;
+    m_scheduler.schedule(overflow_event(channel), state.start + (ticks << PRESCALER_SHIFTS[state.control & PRESCALER]));
+}
@@ -1,8 +1,56 @@
+#ifndef TIMER_HPP
+#define TIMER_HPP
+
 #include <array>
+#include <cstdint>
+
+#include "interrupts.hpp"
+#include "io.hpp"
+#include "scheduler.hpp"
 
-class Timer {
+// The four timers. Counters aren't stepped, each one is latched with the timestamp it started
+// counting from and its value is worked out when it's read, only overflows are scheduled.
+class Timer
+{
     public:
-        Timer() {};
+        Timer(std::uint8_t* mmio, Interrupts& interrupts, Scheduler& scheduler) : m_mmio(mmio), m_interrupts(interrupts), m_scheduler(scheduler) {}
+
+        //! TMxCNT_L reads the counter and writes the reload value
+        void register_io(Io& io);
+        //! overflow event of a timer, timestamp is when it was due
+        void overflow(int channel, std::uint64_t timestamp);
+
+    private:
+        static constexpr std::uint32_t REGS_BASE = 0x100;
+        static constexpr std::uint32_t REGS_SIZE = 4;
+        static constexpr std::array<int, 4> PRESCALER_SHIFTS = {0, 6, 8, 10};
+
+        enum Control : std::uint16_t
+        {
+            PRESCALER = 3, COUNT_UP = 1 << 2, IRQ = 1 << 6, ENABLE = 1 << 7, WRITABLE = PRESCALER | COUNT_UP | IRQ | ENABLE
+        };
+
+        struct Channel
+        {
+            //! counter value at start
+            std::uint16_t counter = 0;
+            std::uint16_t reload = 0;
+            std::uint16_t control = 0;
+            std::uint64_t start = 0;
+        };
+
+        //! counts up on the overflow of the previous timer instead of the clock
+        bool cascaded(int channel) const noexcept { return (channel != 0) && (m_channels[channel].control & COUNT_UP); }
+        bool running(int channel) const noexcept { return (m_channels[channel].control & ENABLE) && !cascaded(channel); }
+        std::uint16_t counter(int channel, std::uint64_t now) const noexcept;
+        void write(std::uint32_t offset, std::uint16_t value, std::uint16_t mask);
+        void schedule_overflow(int channel);
+        static Scheduler::Event overflow_event(int channel) noexcept { return static_cast<Scheduler::Event>(static_cast<int>(Scheduler::Event::TIMER0_OVERFLOW) + channel); }
+
+        std::uint8_t* m_mmio;
+        Interrupts& m_interrupts;
+        Scheduler& m_scheduler;
+        std::array<Channel, 4> m_channels;
+};
 
-        std::array<std::uint8_t, 16> m_mmio;
-};
\ No newline at end of file
+#endif
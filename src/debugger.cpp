@@ -5,7 +5,7 @@
 #include "core/cpu.hpp"
 
 CPU::Registers& Debugger::view_registers() {
-    return m_cpu->m_banked_regs[m_cpu->m_mode];
+    return m_cpu->m_regs;
 }
 
 std::uint32_t Debugger::view_cpsr() {
@@ -17,13 +17,24 @@ std::uint32_t Debugger::view_psr() {
 }
 
 std::uint32_t Debugger::view_pipeline() {
-    return m_cpu->m_pipeline;
+    if (m_cpu->is_thumb_enabled()) {
+        return m_cpu->m_mem.read<std::uint16_t>(current_pc());
+    }
+    return m_cpu->m_mem.read<std::uint32_t>(current_pc());
 }
 
 bool Debugger::is_pipeline_invalid() {
     return m_cpu->m_pipeline_invalid;
 }
 
+std::uint64_t Debugger::view_idle_loop_skips() {
+    return m_cpu->m_idle_loops_skipped;
+}
+
+std::size_t Debugger::view_palette_changes() {
+    return m_cpu->m_mem.ppu().take_palette_changes().count();
+}
+
 // TODO: merge into single function
 std::uint16_t Debugger::view_ie() {
     return m_cpu->m_mem.read<std::uint16_t>(0x04000200);
@@ -33,7 +44,7 @@ std::uint16_t Debugger::view_if() {
 }
 
 std::uint32_t Debugger::current_pc() {
-    return m_cpu->m_banked_regs[m_cpu->m_mode][15] - ((4 >> m_cpu->is_thumb_enabled()) * !m_cpu->m_pipeline_invalid);
+    return m_cpu->m_regs[15] - ((4 >> m_cpu->is_thumb_enabled()) * !m_cpu->m_pipeline_invalid);
 }
 
 const char* Debugger::amod(std::uint8_t pu) {
@@ -370,7 +381,7 @@ void Debugger::print_mul(Instr& instr) {
 void Debugger::decompile_arm_instr(Instr& instr) {
     const char* cond = condition(instr.opcode);
     std::uint16_t opcode = (((instr.opcode >> 20) & 0xFF) << 4) | ((instr.opcode >> 4) & 0xF);
-    switch (m_cpu->m_arm_lut[opcode]) {
+    switch (m_cpu->m_arm_formats[opcode]) {
     case CPU::InstrFormat::NOP: {
         instr.desc = "NOP";
         break;
@@ -413,7 +424,7 @@ void Debugger::decompile_arm_instr(Instr& instr) {
     }
     case CPU::InstrFormat::MUL: return print_mul(instr);
     default:
-        // printf("%hhu\n", m_cpu->m_arm_lut[opcode]);
+        // printf("%hhu\n", m_cpu->m_arm_formats[opcode]);
         // std::exit(1);
     }
 }
@@ -631,8 +642,8 @@ std::array<Debugger::Instr, 64> Debugger::view_nearby_instructions() {
     std::array<Debugger::Instr, 64> instrs{};
 
     std::int64_t num_instrs = ((instrs.size() / 2) * (4 >> m_cpu->is_thumb_enabled()));
-    std::int64_t start = m_cpu->m_banked_regs[m_cpu->m_mode][15] - num_instrs;
-    std::int64_t end = m_cpu->m_banked_regs[m_cpu->m_mode][15] + num_instrs;
+    std::int64_t start = m_cpu->m_regs[15] - num_instrs;
+    std::int64_t end = m_cpu->m_regs[15] + num_instrs;
 
     for (std::int64_t addr = start; addr < end; addr += (4 >> m_cpu->is_thumb_enabled())) {
         if (addr < 0) continue;
@@ -26,6 +26,9 @@ class Debugger {
         std::uint16_t view_ie();
         std::uint32_t view_pipeline();
         bool is_pipeline_invalid();
+        std::uint64_t view_idle_loop_skips();
+        //! number of palette colours written since the last call
+        std::size_t view_palette_changes();
 
         std::uint32_t current_pc();
         std::array<Instr, 64> view_nearby_instructions();
@@ -16,7 +16,14 @@ const int GBA_WIDTH = 240;
 
 void Window::initialize_gba(const std::string&& rom_filepath) {
     m_inserted_rom = std::filesystem::path(rom_filepath).filename();
+    // the previous cpu has to be gone before the new one maps its memory, only one fastmem window exists at a time
+    m_debugger.reset();
+    m_cpu.reset();
     m_cpu = std::make_shared<CPU>(rom_filepath);
+    m_cpu->set_jit_enabled(m_menu_bar.m_toggle_jit);
+    m_cpu->set_hle_bios_enabled(m_menu_bar.m_toggle_hle_bios);
+    if (!m_cpu->set_fastmem_enabled(m_menu_bar.m_toggle_fastmem)) m_menu_bar.m_toggle_fastmem = false;
+    m_menu_bar.m_toggle_idle_loop_skipping = m_cpu->idle_loop_skipping();
     m_debugger = std::make_unique<Debugger>(m_cpu);
 }
 
@@ -72,6 +79,19 @@ void Window::render_backdrop_window() {
         if (ImGui::BeginMenu("Debug")) {
             ImGui::MenuItem("Debug Panel", nullptr, &m_menu_bar.m_toggle_debug_panel);
             ImGui::MenuItem("ImGui Demo", nullptr, &m_menu_bar.m_toggle_demo_window);
+            if (ImGui::MenuItem("JIT Recompiler", nullptr, &m_menu_bar.m_toggle_jit) && m_cpu) {
+                if (!m_cpu->set_jit_enabled(m_menu_bar.m_toggle_jit)) m_menu_bar.m_toggle_jit = false;
+            }
+            if (ImGui::MenuItem("Idle Loop Skipping", nullptr, &m_menu_bar.m_toggle_idle_loop_skipping) && m_cpu) {
+                m_cpu->set_idle_loop_skipping(m_menu_bar.m_toggle_idle_loop_skipping);
+                m_cpu->save_idle_loop_skipping();
+            }
+            if (ImGui::MenuItem("HLE BIOS", nullptr, &m_menu_bar.m_toggle_hle_bios) && m_cpu) {
+                m_cpu->set_hle_bios_enabled(m_menu_bar.m_toggle_hle_bios);
+            }
+            if (ImGui::MenuItem("Fastmem", nullptr, &m_menu_bar.m_toggle_fastmem) && m_cpu) {
+                if (!m_cpu->set_fastmem_enabled(m_menu_bar.m_toggle_fastmem)) m_menu_bar.m_toggle_fastmem = false;
+            }
             ImGui::EndMenu();
         }
         m_menu_bar_height = ImGui::GetFrameHeight();
@@ -243,6 +263,12 @@ void Window::render_debug_window() {
         ImGui::TableSetColumnIndex(1);
         ImGui::Text("flush?: %s", m_debugger->is_pipeline_invalid() ? "YES" : "NO");
 
+        ImGui::TableNextRow();
+        ImGui::TableSetColumnIndex(0);
+        ImGui::Text("idle skips: %llu", static_cast<unsigned long long>(m_debugger->view_idle_loop_skips()));
+        ImGui::TableSetColumnIndex(1);
+        ImGui::Text("palette writes: %zu", m_debugger->view_palette_changes());
+
         ImGui::EndTable();
     }
 
@@ -11,11 +11,15 @@
 
 class Window {
     struct MenuBar {
-        MenuBar() : m_toggle_debug_panel(false), m_toggle_demo_window(false), m_toggle_file_explorer(false) {};
+        MenuBar() : m_toggle_debug_panel(false), m_toggle_demo_window(false), m_toggle_file_explorer(false), m_toggle_jit(false), m_toggle_idle_loop_skipping(true), m_toggle_hle_bios(false), m_toggle_fastmem(false) {};
 
         bool m_toggle_debug_panel;
         bool m_toggle_demo_window;
         bool m_toggle_file_explorer;
+        bool m_toggle_jit;
+        bool m_toggle_idle_loop_skipping;
+        bool m_toggle_hle_bios;
+        bool m_toggle_fastmem;
     };
 
     public: